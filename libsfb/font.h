@@ -31,6 +31,28 @@
  ****************************************************************************/
 #include <stdlib.h>
 
+/**
+ * @brief An entry of the sorted glyph index above U+00FF
+ */
+typedef struct fbwide_s {
+    wchar_t wc;                 /*!< wide character (unicode) */
+    unsigned short glyph;       /*!< glyph number in the map */
+}   fbwide_t;
+
+/**
+ * @brief Glyph lookup index of a font
+ *
+ * The index is built from the @p map once, when the font is first
+ * selected. Code points up to U+00FF are looked up directly, higher
+ * ones with a binary search. Missing glyphs map to glyph 0.
+ */
+typedef struct fbindex_s {
+    int valid;                  /*!< non-zero once the index is built */
+    unsigned short latin1[256]; /*!< glyph numbers for U+0000 to U+00FF */
+    int nwide;                  /*!< number of entries in @p wide */
+    fbwide_t* wide;             /*!< glyph numbers above U+00FF sorted by code point */
+}   fbindex_t;
+
 /**
  * @brief the frame buffer font structure contains information
  * and pointers to data for a bitmapped font.
@@ -45,12 +67,16 @@
  * words (uint16_t) or dwords (uint32_t).
  *
  * There is one element per glyph row (height).
+ *
+ * The @p index points to writable storage for the glyph lookup
+ * index, or is NULL to search the @p map linearly.
  */
 typedef struct fbfont_s {
     int w;                      /*!< font cell width */
     int h;                      /*!< font cell height */
     const wchar_t* map;         /*!< map of wide characters (unicode) */
     const void* data;           /*!< font definition bitmaps */
+    struct fbindex_s* index;    /*!< glyph lookup index for the map */
 }   fbfont_t;
 
 extern const fbfont_t font_6x12;
@@ -4294,4 +4294,6 @@ static const wchar_t font_10x20_map[] = {
     0x0000
 };
 
-const fbfont_t font_10x20 = { 10, 20, font_10x20_map, font_10x20_data };
+static fbindex_t font_10x20_index;
+
+const fbfont_t font_10x20 = { 10, 20, font_10x20_map, font_10x20_data, &font_10x20_index };
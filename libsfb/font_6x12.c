@@ -2773,4 +2773,6 @@ static const wchar_t font_6x12_map[] = {
     0x0000
 };
 
-const fbfont_t font_6x12 = { 6, 12, font_6x12_map, font_6x12_data };
+static fbindex_t font_6x12_index;
+
+const fbfont_t font_6x12 = { 6, 12, font_6x12_map, font_6x12_data, &font_6x12_index };
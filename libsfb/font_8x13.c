@@ -2950,4 +2950,6 @@ static const wchar_t font_8x13_map[] = {
     0x0000
 };
 
-const fbfont_t font_8x13 = { 8, 13, font_8x13_map, font_8x13_data };
+static fbindex_t font_8x13_index;
+
+const fbfont_t font_8x13 = { 8, 13, font_8x13_map, font_8x13_data, &font_8x13_index };
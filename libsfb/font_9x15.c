@@ -3334,4 +3334,6 @@ static const wchar_t font_9x15_map[] = {
     0x0000
 };
 
-const fbfont_t font_9x15 = { 9, 15, font_9x15_map, font_9x15_data };
+static fbindex_t font_9x15_index;
+
+const fbfont_t font_9x15 = { 9, 15, font_9x15_map, font_9x15_data, &font_9x15_index };
@@ -42,6 +42,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
 #if defined(HAVE_STDINT_H)
 #include <stdint.h>
 #endif
@@ -73,6 +74,19 @@
 #include <gd.h>
 #endif
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define	SFB_THREADS 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define	SFB_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define	SFB_NEON 1
+#endif
+
 #include "font.h"
 #include "sfb.h"
 
@@ -90,6 +104,58 @@
 
 #define	SFB_MAGIC   0x71a8402bu
 
+/**
+ * @brief Maximum number of entries in a dash pattern
+ */
+#define	MAX_DASH	8
+
+/**
+ * @brief Minimum length of a non-zero dash pattern entry in pixels
+ *
+ * Shorter entries would not advance the position along a line in
+ * floating point, so they are rounded up.
+ */
+#define	DASH_MIN	(1.0f / 16.0f)
+
+/**
+ * @brief Kinds of coordinate transform, see @ref xform_update()
+ */
+#define	XFORM_NONE	0
+#define	XFORM_SCALE	1
+#define	XFORM_AFFINE	2
+
+/**
+ * @brief Maximum number of glyphs in the glyph cache
+ */
+#define	GLYPH_CACHE	256
+
+/**
+ * @brief Number of hash buckets of the glyph cache (a power of 2)
+ */
+#define	GLYPH_HASH	128
+
+/**
+ * @brief Maximum number of glyphs composed per text scanline
+ *
+ * At most half of @ref GLYPH_CACHE, so that looking up a chunk of
+ * glyphs never evicts one of them. A full width line of the 6x12 font
+ * is one chunk on panels up to 768 pixels wide.
+ */
+#define	TEXT_GLYPHS	128
+
+/**
+ * @brief Size of the stack staging buffer for text scanlines in bytes
+ *
+ * Only used if the staging buffer of the context, which holds a full
+ * frame buffer row, cannot be allocated.
+ */
+#define	TEXT_STAGE	4096
+
+/**
+ * @brief Size of the stack buffer of fb_printf() in bytes
+ */
+#define	PRINTF_STACK	256
+
 typedef struct sfb_s {
     /** @brief magic value to check for invalid sfb_s* */
     uint32_t magic;
@@ -124,9 +190,15 @@ typedef struct sfb_s {
     /** @brief frame buffer stride for scan lines */
     size_t stride;
 
-    /** @brief frame buffer pointer to memory map */
+    /** @brief frame buffer pointer to draw to (memory map or shadow buffer) */
     uint8_t *fbp;
 
+    /** @brief frame buffer pointer to memory map */
+    uint8_t *devp;
+
+    /** @brief shadow buffer in normal memory, or NULL */
+    uint8_t *shadow;
+
     /** @brief pointer to the function to convert R, G, and B to a pixel value */
     color_t (*rgb2pix)(int r, int g, int b);
 
@@ -142,6 +214,27 @@ typedef struct sfb_s {
     /** @brief pointer to the function to write a vertical line for a specific depth */
     void (*vline)(struct sfb_s* sfb, int x, int y, int l);
 
+    /** @brief pointer to the function to blend the foreground color into a pixel for a specific depth */
+    void (*blendpixel)(struct sfb_s* sfb, int x, int y, uint32_t a);
+
+    /** @brief pointer to the function to blend a row of coverage values for a specific depth */
+    void (*covspan)(struct sfb_s* sfb, int x, int y, const uint8_t* cov, int l);
+
+    /** @brief pointer to the function to composite a row of premultiplied ARGB pixels for a specific depth */
+    void (*blendspan)(struct sfb_s* sfb, int x, int y, const argb_t* src, int l);
+
+    /** @brief pointer to the function to fill a horizontal span (solid or with the brush) */
+    void (*fillspan)(struct sfb_s* sfb, int x, int y, int l);
+
+    /** @brief pointer to the function to set a pixel for a specific depth, ignoring the raster operation */
+    void (*setpixel_copy)(struct sfb_s* sfb, int x, int y);
+
+    /** @brief pointer to the function to write a horizontal line for a specific depth, ignoring the raster operation */
+    void (*hline_copy)(struct sfb_s* sfb, int x, int y, int l);
+
+    /** @brief pointer to the function to write a vertical line for a specific depth, ignoring the raster operation */
+    void (*vline_copy)(struct sfb_s* sfb, int x, int y, int l);
+
     /** @brief pointer to font to use */
     const fbfont_t* font;
 
@@ -154,11 +247,128 @@ typedef struct sfb_s {
     /** @brief current foreground color */
     color_t fgcolor;
 
+    /** @brief raster operation of the setpixel, hline and vline kernels */
+    rop_e rop;
+
+    /** @brief four pixels in frame buffer format for each nibble of a bitmap */
+    uint8_t lut[16][16];
+
+    /** @brief foreground color of the nibble lookup table */
+    color_t lut_fg;
+
+    /** @brief background color of the nibble lookup table */
+    color_t lut_bg;
+
+    /** @brief non-zero if the nibble lookup table is built */
+    int lut_valid;
+
+    /** @brief ordered dithering for gradients at 16 bpp */
+    int dither;
+
+    /** @brief brush tile rows in frame buffer format (NULL for solid fills) */
+    uint8_t* brush;
+
+    /** @brief brush tile width in pixels (a multiple of the pattern width) */
+    int brush_w;
+
+    /** @brief brush tile height in pixels */
+    int brush_h;
+
+    /** @brief brush pattern width in pixels */
+    int brush_pw;
+
+    /** @brief brush tile stride in bytes */
+    size_t brush_stride;
+
+    /** @brief brush origin x coordinate */
+    int brush_x;
+
+    /** @brief brush origin y coordinate */
+    int brush_y;
+
+    /** @brief stipple pattern bits */
+    uint8_t stipple[8];
+
+    /** @brief foreground color the stipple tile was built with */
+    color_t brush_fg;
+
+    /** @brief background color the stipple tile was built with */
+    color_t brush_bg;
+
     /** @brief cursor x coordinate */
     int cursor_x;
 
     /** @brief cursor y coordinate */
     int cursor_y;
+
+    /** @brief first row of the text region */
+    int text_y1;
+
+    /** @brief last row of the text region */
+    int text_y2;
+
+    /** @brief line width for strokes */
+    float line_width;
+
+    /** @brief line join style for strokes */
+    line_join_e line_join;
+
+    /** @brief line cap style for strokes */
+    line_cap_e line_cap;
+
+    /** @brief miter limit for strokes */
+    float miter_limit;
+
+    /** @brief dash pattern lengths */
+    float dash[MAX_DASH];
+
+    /** @brief number of dash pattern lengths (0 for solid lines) */
+    int ndash;
+
+    /** @brief offset into the dash pattern */
+    float dash_offset;
+
+    /** @brief outline path used by the stroker */
+    struct sfb_path_s* stroke;
+
+    /** @brief transform x' = xm[0] x + xm[1] y + xm[2], y' = xm[3] x + xm[4] y + xm[5] */
+    float xm[6];
+
+    /** @brief the transform in 16.16 fixed point */
+    int32_t xf[6];
+
+    /** @brief translation of the transform for pixel centers in 16.16 fixed point */
+    int32_t xc[2];
+
+    /** @brief XFORM_NONE, XFORM_SCALE (scale and translate) or XFORM_AFFINE */
+    int xform;
+
+    /** @brief scale factor for circle radii */
+    float xr;
+
+    /** @brief scale factor for horizontal ellipse radii */
+    float xrx;
+
+    /** @brief scale factor for vertical ellipse radii */
+    float xry;
+
+    /** @brief glyph cache hash buckets */
+    struct glyph_s* gc_hash[GLYPH_HASH];
+
+    /** @brief most recently used cached glyph */
+    struct glyph_s* gc_newest;
+
+    /** @brief least recently used cached glyph */
+    struct glyph_s* gc_oldest;
+
+    /** @brief number of cached glyphs */
+    int gc_count;
+
+    /** @brief staging buffer for composing text scanlines */
+    uint8_t* text_stage;
+
+    /** @brief size of @p text_stage in bytes */
+    size_t text_stage_size;
 }   sfb_t;
 
 /**
@@ -275,6 +485,36 @@ static color_t rgb2pix_32bpp(int r, int g, int b)
 	    (0xff000000);
 }
 
+/**
+ * @brief Convert a pixel value of the frame buffer's depth to opaque ARGB 8-8-8-8
+ * @param fb pointer to the frame buffer context
+ * @param pix pixel value
+ * @return ARGB value
+ */
+static argb_t pix2argb(sfb_t* fb, color_t pix)
+{
+    uint32_t r, g, b;
+    switch (fb->bpp) {
+    case 1:
+	r = g = b = pix ? 0xff : 0x00;
+	break;
+    case 8:
+	r = g = b = pix & 0xff;
+	break;
+    case 16:
+	r = ((pix >> 8) & 0xf8) | ((pix >> 13) & 0x07);
+	g = ((pix >> 3) & 0xfc) | ((pix >>  9) & 0x03);
+	b = ((pix << 3) & 0xf8) | ((pix >>  2) & 0x07);
+	break;
+    default:
+	r = (pix >> 16) & 0xff;
+	g = (pix >>  8) & 0xff;
+	b = (pix >>  0) & 0xff;
+	break;
+    }
+    return 0xff000000u | (r << 16) | (g << 8) | b;
+}
+
 /**
  * @brief check if coordinates x and y are in range
  * 0 <= x < w and 0 <= y < h
@@ -302,10 +542,10 @@ static color_t getpixel_1bpp(sfb_t* fb, int x, int y)
     CHECK_RANGE_GETPIXEL(fb);
 
     off_t pos =
-	    ((x + fb->x) + 7) / 8 +
+	    (x + fb->x) / 8 +
 	    (y + fb->y) * fb->stride;
 
-    return (fb->fbp[pos] >> (x & 7)) & 1;
+    return (fb->fbp[pos] >> (7 - (x & 7))) & 1;
 }
 
 /**
@@ -416,7 +656,7 @@ static void setpixel_1bpp(sfb_t* fb, int x, int y)
     CHECK_RANGE_SETPIXEL(fb);
 
     off_t pos =
-	    ((x + fb->x) + 7) / 8 +
+	    (x + fb->x) / 8 +
 	    (y + fb->y) * fb->stride;
 
     if (fb->fgcolor) {
@@ -543,7 +783,7 @@ static void hline_1bpp(sfb_t* fb, int x, int y, int l)
     CHECK_RANGE_HLINE(fb);
 
     off_t pos =
-	    ((x + fb->x) + 7) / 8 +
+	    (x + fb->x) / 8 +
 	    (y + fb->y) * fb->stride;
 
     if (fb->fgcolor) {
@@ -695,7 +935,7 @@ static void vline_1bpp(sfb_t* fb, int x, int y, int l)
     CHECK_RANGE_VLINE(fb);
 
     off_t pos =
-	    ((x + fb->x) + 7) / 8 +
+	    (x + fb->x) / 8 +
 	    (y + fb->y) * fb->stride;
 
     if (fb->fgcolor) {
@@ -806,216 +1046,6150 @@ static void vline_32bpp(sfb_t* fb, int x, int y, int l)
 }
 
 /**
- * @brief Draw a line from @p x1, @p y1 to @p x2, @p y2
- *
- * @param fb pointer to the frame buffer context
- * @param x1 line start x coordinate
- * @param y1 line start y coordinate
- * @param x2 line end x coordinate
- * @param y2 line end y coordinate
+ * @brief Combine the destination byte @p d with the source byte @p s
+ * @param op raster operation
+ * @param d destination byte
+ * @param s source (foreground color) byte
+ * @return resulting byte
  */
-void fb_line(sfb_t *fb, int x1, int y1, int x2, int y2)
+static inline uint8_t rop8(rop_e op, uint8_t d, uint8_t s)
 {
-    CHECK_FB(fb);
-    const int sx = x1 < x2 ? 1 : -1;
-    const int sy = y1 < y2 ? 1 : -1;
-    const int dx = abs(x2 - x1);
-    const int dy = abs(y2 - y1);
-
-    if (dx >= dy) {
-	// Loop for x coordinates
-	int dda = dx / 2;
-	while (x1 != x2) {
-	    fb->setpixel(fb, x1, y1);
-	    x1 += sx;
-	    dda -= dy;
-	    if (dda <= 0) {
-		y1 += sy;
-		dda += dx;
-	    }
-	}
-    } else {
-	// Loop for y coordinates
-	int dda = dy / 2;
-	while (y1 != y2) {
-	    fb->setpixel(fb, x1, y1);
-	    y1 += sy;
-	    dda -= dx;
-	    if (dda <= 0) {
-		x1 += sx;
-		dda += dy;
-	    }
-	}
+    switch (op) {
+    case rop_xor:
+	return d ^ s;
+    case rop_and:
+	return d & s;
+    case rop_or:
+	return d | s;
+    case rop_invert:
+	return (uint8_t)~d;
+    default:
+	return s;
     }
 }
 
 /**
- * @brief Draw a rectangle at @p x1, @p y1 to @p x2, @p y2
+ * @brief Apply the raster operation @p op to a run of @p l pixels
+ *
+ * The caller has clipped the run. With a constant @p op the compiler
+ * folds the operation, so every wrapper below is a specialised kernel.
+ * At 32 bpp the alpha byte is left alone.
  *
  * @param fb pointer to the frame buffer context
- * @param x1 first corner x coordinate
- * @param y1 first corner y coordinate
- * @param x2 opposite corner x coordinate
- * @param y2 opposite corner y coordinate
+ * @param x coordinate
+ * @param y coordinate
+ * @param l length in pixels
+ * @param vertical non-zero to walk down instead of right
+ * @param op raster operation
  */
-void fb_rect(sfb_t *fb, int x1, int y1, int x2, int y2)
+static inline void rop_run(sfb_t* fb, int x, int y, int l, int vertical, rop_e op)
 {
-    CHECK_FB(fb);
-    const int tl_x = x1 <= x2 ? x1 : x2;
-    const int tl_y = y1 <= y2 ? y1 : y2;
-    const int br_x = x1 > x2 ? x1 : x2;
-    const int br_y = y1 > y2 ? y1 : y2;
-    const int w = br_x + 1 - tl_x;
-    const int h = br_y + 1 - tl_y;
+    if (1 == fb->bpp) {
+	const uint8_t s = fb->fgcolor ? 0xff : 0x00;
+	while (l-- > 0) {
+	    const off_t pos =
+		    (x + fb->x) / 8 +
+		    (y + fb->y) * fb->stride;
+	    const uint8_t m = 0x80 >> (x & 7);
+	    fb->fbp[pos] = (fb->fbp[pos] & ~m) | (rop8(op, fb->fbp[pos], s) & m);
+	    if (vertical)
+		y++;
+	    else
+		x++;
+	}
+	return;
+    }
 
-    fb->hline(fb, tl_x, tl_y, w);
-    fb->hline(fb, tl_x, br_y, w);
-    fb->vline(fb, tl_x, tl_y, h);
-    fb->vline(fb, br_x, tl_y, h);
+    const int bpx = fb->bpp / 8;
+    const int nb = MIN(bpx, 3);
+    const size_t step = vertical ? fb->stride : (size_t)bpx;
+    const uint8_t s[3] = {
+	(uint8_t)(fb->fgcolor >>  0),
+	(uint8_t)(fb->fgcolor >>  8),
+	(uint8_t)(fb->fgcolor >> 16)
+    };
+    off_t pos =
+	    (x + fb->x) * bpx +
+	    (y + fb->y) * fb->stride;
+
+    while (l-- > 0) {
+	for (int c = 0; c < nb; c++)
+	    fb->fbp[pos+c] = rop8(op, fb->fbp[pos+c], s[c]);
+	pos += step;
+    }
 }
 
 /**
- * @brief Fill a rectangle at @p x1, @p y1 to @p x2, @p y2
- *
- * @param fb pointer to the frame buffer context
- * @param x1 first corner x coordinate
- * @param y1 first corner y coordinate
- * @param x2 opposite corner x coordinate
- * @param y2 opposite corner y coordinate
+ * @brief XOR the foreground color into the pixel at @p x and @p y
  */
-void fb_fill(sfb_t *fb, int x1, int y1, int x2, int y2)
+static void setpixel_xor(sfb_t* fb, int x, int y)
 {
-    CHECK_FB(fb);
-    const int tl_x = x1 <= x2 ? x1 : x2;
-    const int tl_y = y1 <= y2 ? y1 : y2;
-    const int br_x = x1 > x2 ? x1 : x2;
-    const int br_y = y1 > y2 ? y1 : y2;
-    const int w = br_x + 1 - tl_x;
-    const int h = br_y + 1 - tl_y;
+    CHECK_RANGE_SETPIXEL(fb);
+    rop_run(fb, x, y, 1, 0, rop_xor);
+}
 
-    for (int i = 0; i < h; i++)
-	fb->hline(fb, tl_x, tl_y + i, w);
+/**
+ * @brief XOR the foreground color into a horizontal line
+ */
+static void hline_xor(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_HLINE(fb);
+    rop_run(fb, x, y, l, 0, rop_xor);
 }
 
 /**
- * @brief Draw a circle's octants @p oct at @p x, @p y with radius @p r
- *
- * @param fb pointer to the frame buffer context
- * @param oct octants to draw (0 … 7 for counter-clockwise octants)
- * @param x center x coordinate
- * @param y center y coordinate
- * @param r radius in pixels
+ * @brief XOR the foreground color into a vertical line
  */
-void fb_circle_octants(sfb_t *fb, uint8_t oct, int x, int y, int r)
+static void vline_xor(sfb_t* fb, int x, int y, int l)
 {
-    CHECK_FB(fb);
-    int dda = r;
-    int dx = r;
-    int dy = 0;
-    while (dx >= dy) {
-	if (oct & (1 << 0))
-	    fb->setpixel(fb, x + dx, y - dy);
-	if (oct & (1 << 1))
-	    fb->setpixel(fb, x + dy, y - dx);
-	if (oct & (1 << 2))
-	    fb->setpixel(fb, x - dy, y - dx);
-	if (oct & (1 << 3))
-	    fb->setpixel(fb, x - dx, y - dy);
-	if (oct & (1 << 4))
-	    fb->setpixel(fb, x - dx, y + dy);
-	if (oct & (1 << 5))
-	    fb->setpixel(fb, x - dy, y + dx);
-	if (oct & (1 << 6))
-	    fb->setpixel(fb, x + dy, y + dx);
-	if (oct & (1 << 7))
-	    fb->setpixel(fb, x + dx, y + dy);
+    CHECK_RANGE_VLINE(fb);
+    rop_run(fb, x, y, l, 1, rop_xor);
+}
 
-	dy++;
-	dda -= dy;
-	if (dda < 0) {
-	    dda += dx;
-	    dx--;
-	}
-    }
+/**
+ * @brief AND the foreground color into the pixel at @p x and @p y
+ */
+static void setpixel_and(sfb_t* fb, int x, int y)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+    rop_run(fb, x, y, 1, 0, rop_and);
 }
 
 /**
- * @brief Draw a circle at @p x, @p y with radius @p r
- *
- * @param fb pointer to the frame buffer context
- * @param x center x coordinate
- * @param y center y coordinate
- * @param r radius in pixels
+ * @brief AND the foreground color into a horizontal line
  */
-void fb_circle(sfb_t *fb, int x, int y, int r)
+static void hline_and(sfb_t* fb, int x, int y, int l)
 {
-    CHECK_FB(fb);
-    fb_circle_octants(fb, 0xff, x, y, r);
+    CHECK_RANGE_HLINE(fb);
+    rop_run(fb, x, y, l, 0, rop_and);
 }
 
 /**
- * @brief Draw a disc's octants @p oct at @p x, @p y with radius @p r
- *
- * @param fb pointer to the frame buffer context
- * @param oct octants to draw (0 … 7 for counter-clockwise octants)
- * @param x center x coordinate
- * @param y center y coordinate
- * @param r radius in pixels
+ * @brief AND the foreground color into a vertical line
  */
-void fb_disc_octants(sfb_t *fb, uint8_t oct, int x, int y, int r)
+static void vline_and(sfb_t* fb, int x, int y, int l)
 {
-    CHECK_FB(fb);
-    int dda = r;
-    int dx = r;
-    int dy = 0;
-    while (dx >= dy) {
-	const int l = dx - dy;
-	if (oct & (1 << 0))
-	    fb->hline(fb, x + dy, y - dy, l);
-	if (oct & (1 << 1))
-	    fb->vline(fb, x + dy, y - dx, l);
-	if (oct & (1 << 2))
-	    fb->vline(fb, x - dy, y - dx, l);
-	if (oct & (1 << 3))
-	    fb->hline(fb, x - dx, y - dy, l + 1); // FIXME: + 1 or there is a gap?
-	if (oct & (1 << 4))
-	    fb->hline(fb, x - dx, y + dy, l);
-	if (oct & (1 << 5))
-	    fb->vline(fb, x - dy, y + dy, l);
-	if (oct & (1 << 6))
-	    fb->vline(fb, x + dy, y + dy, l);
-	if (oct & (1 << 7))
-	    fb->hline(fb, x + dy, y + dy, l);
-	dy++;
-	dda -= dy;
-	if (dda < 0) {
-	    dda += dx;
-	    dx--;
-	}
-    }
+    CHECK_RANGE_VLINE(fb);
+    rop_run(fb, x, y, l, 1, rop_and);
 }
 
 /**
- * @brief Draw a dist at @p x, @p y with radius @p r
- *
- * @param fb pointer to the frame buffer context
- * @param x center x coordinate
- * @param y center y coordinate
- * @param r radius in pixels
+ * @brief OR the foreground color into the pixel at @p x and @p y
  */
-void fb_disc(sfb_t *fb, int x, int y, int r)
+static void setpixel_or(sfb_t* fb, int x, int y)
 {
-    CHECK_FB(fb);
-    fb_disc_octants(fb, 0xff, x, y, r);
+    CHECK_RANGE_SETPIXEL(fb);
+    rop_run(fb, x, y, 1, 0, rop_or);
 }
 
 /**
- * @brief Initialize the framebuffer device info and map to memory
- * @param sfb pointer to the frame buffer context pointer
- * @param devname device name like "/dev/fb1"
- * @return 0 on success, or < 0 on error
+ * @brief OR the foreground color into a horizontal line
  */
-int fb_init(struct sfb_s** sfb, const char* devname)
+static void hline_or(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_HLINE(fb);
+    rop_run(fb, x, y, l, 0, rop_or);
+}
+
+/**
+ * @brief OR the foreground color into a vertical line
+ */
+static void vline_or(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_VLINE(fb);
+    rop_run(fb, x, y, l, 1, rop_or);
+}
+
+/**
+ * @brief Invert the pixel at @p x and @p y
+ */
+static void setpixel_invert(sfb_t* fb, int x, int y)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+    rop_run(fb, x, y, 1, 0, rop_invert);
+}
+
+/**
+ * @brief Invert a horizontal line
+ */
+static void hline_invert(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_HLINE(fb);
+    rop_run(fb, x, y, l, 0, rop_invert);
+}
+
+/**
+ * @brief Invert a vertical line
+ */
+static void vline_invert(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_VLINE(fb);
+    rop_run(fb, x, y, l, 1, rop_invert);
+}
+
+/**
+ * @brief Blend an 8 bit channel @p s over @p d with alpha @p a
+ * @param d destination channel value (0 … 255)
+ * @param s source channel value (0 … 255)
+ * @param a alpha (0 … 255)
+ * @return blended channel value
+ */
+static inline uint32_t blend8(uint32_t d, uint32_t s, uint32_t a)
+{
+    const uint32_t t = d * (255 - a) + s * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/**
+ * @brief Linear interpolation tables for RGB 5-6-5 channels
+ *
+ * lerp5[a][s - d + 31] and lerp6[a][s - d + 63] hold the rounded
+ * value of (s - d) * a / 63 for a 6 bit alpha @p a, so blending a
+ * 16 bpp pixel takes one table lookup and one add per channel.
+ */
+static int8_t lerp5[64][63];
+static int8_t lerp6[64][127];
+
+/**
+ * @brief Fill the RGB 5-6-5 interpolation tables once
+ */
+static void init_lerp_tables(void)
+{
+    static int done = 0;
+    if (done)
+	return;
+    for (int a = 0; a < 64; a++) {
+	for (int d = -31; d <= 31; d++)
+	    lerp5[a][d + 31] = (int8_t)((d * a + (d < 0 ? -31 : 31)) / 63);
+	for (int d = -63; d <= 63; d++)
+	    lerp6[a][d + 63] = (int8_t)((d * a + (d < 0 ? -31 : 31)) / 63);
+    }
+    done = 1;
+}
+
+/**
+ * @brief Blend the RGB 5-6-5 pixel @p s over @p d with alpha @p a
+ * @param d destination pixel
+ * @param s source pixel
+ * @param a alpha (0 … 255)
+ * @return blended pixel
+ */
+static inline uint32_t blend565(uint32_t d, uint32_t s, uint32_t a)
+{
+    const int8_t* l5 = lerp5[a >> 2];
+    const int8_t* l6 = lerp6[a >> 2];
+    const int dr = (d >> 11) & 0x1f;
+    const int dg = (d >>  5) & 0x3f;
+    const int db = (d >>  0) & 0x1f;
+    const int r = dr + l5[(int)((s >> 11) & 0x1f) - dr + 31];
+    const int g = dg + l6[(int)((s >>  5) & 0x3f) - dg + 63];
+    const int b = db + l5[(int)((s >>  0) & 0x1f) - db + 31];
+    return (uint32_t)((r << 11) | (g << 5) | b);
+}
+
+/**
+ * @brief check if coordinates x and y are in range
+ * adjust l and cov if x < 0 or x + l > w
+ * 0 <= x < w and 0 <= y < h and l > 0
+ * otherwise return
+ */
+#define	CHECK_RANGE_COVSPAN(_fb) do {	\
+    if (x < 0) {			\
+	l += x;				\
+	cov -= x;			\
+	x = 0;				\
+    }					\
+    if (x + l >= (_fb)->w) {		\
+	l = (_fb)->w - x;		\
+    }					\
+    if (l <= 0 ||			\
+	y < 0 ||			\
+	y >= (_fb)->h) {		\
+	return;				\
+    }					\
+} while (0)
+
+/**
+ * @brief Blend the foreground color into a row using coverage values
+ * The frame buffer has 1 bit per pixel, so coverage is thresholded
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param cov array of @p l coverage values (0 … 255)
+ * @param l length in pixels
+ */
+static void covspan_1bpp(sfb_t* fb, int x, int y, const uint8_t* cov, int l)
+{
+    CHECK_RANGE_COVSPAN(fb);
+
+    for (int i = 0; i < l; i++) {
+	if (cov[i] >= 128)
+	    setpixel_1bpp(fb, x + i, y);
+    }
+}
+
+/**
+ * @brief Blend the foreground color into a row using coverage values
+ * The frame buffer has 8 bits per pixel (gray scale)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param cov array of @p l coverage values (0 … 255)
+ * @param l length in pixels
+ */
+static void covspan_8bpp(sfb_t* fb, int x, int y, const uint8_t* cov, int l)
+{
+    CHECK_RANGE_COVSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) +
+	    (y + fb->y) * fb->stride;
+    const uint32_t fg = (uint8_t)fb->fgcolor;
+
+    for (int i = 0; i < l; i++, pos++) {
+	const uint32_t a = cov[i];
+	if (0 == a)
+	    continue;
+	if (255 == a)
+	    fb->fbp[pos] = (uint8_t)fg;
+	else
+	    fb->fbp[pos] = (uint8_t)blend8(fb->fbp[pos], fg, a);
+    }
+}
+
+/**
+ * @brief Blend the foreground color into a row using coverage values
+ * The frame buffer has 16 bits per pixel (RGB 5-6-5)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param cov array of @p l coverage values (0 … 255)
+ * @param l length in pixels
+ */
+static void covspan_16bpp(sfb_t* fb, int x, int y, const uint8_t* cov, int l)
+{
+    CHECK_RANGE_COVSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 2 +
+	    (y + fb->y) * fb->stride;
+
+    for (int i = 0; i < l; i++, pos += 2) {
+	const uint32_t a = cov[i];
+	if (0 == a)
+	    continue;
+	if (255 == a) {
+	    fb->fbp[pos+0] = (uint8_t)(fb->fgcolor >> 0);
+	    fb->fbp[pos+1] = (uint8_t)(fb->fgcolor >> 8);
+	    continue;
+	}
+	const uint32_t p = fb->fbp[pos+0] | ((uint32_t)fb->fbp[pos+1] << 8);
+	const uint32_t q = blend565(p, fb->fgcolor, a);
+	fb->fbp[pos+0] = (uint8_t)(q >> 0);
+	fb->fbp[pos+1] = (uint8_t)(q >> 8);
+    }
+}
+
+/**
+ * @brief Blend the foreground color into a row using coverage values
+ * The frame buffer has 24 bits per pixel (RGB 8-8-8)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param cov array of @p l coverage values (0 … 255)
+ * @param l length in pixels
+ */
+static void covspan_24bpp(sfb_t* fb, int x, int y, const uint8_t* cov, int l)
+{
+    CHECK_RANGE_COVSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 3 +
+	    (y + fb->y) * fb->stride;
+
+    for (int i = 0; i < l; i++, pos += 3) {
+	const uint32_t a = cov[i];
+	if (0 == a)
+	    continue;
+	for (int c = 0; c < 3; c++) {
+	    const uint32_t s = (fb->fgcolor >> (8 * c)) & 0xff;
+	    fb->fbp[pos+c] = (uint8_t)blend8(fb->fbp[pos+c], s, a);
+	}
+    }
+}
+
+/**
+ * @brief Blend the foreground color into a row using coverage values
+ * The frame buffer has 32 bits per pixel (ARGB 8-8-8-8)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param cov array of @p l coverage values (0 … 255)
+ * @param l length in pixels
+ */
+static void covspan_32bpp(sfb_t* fb, int x, int y, const uint8_t* cov, int l)
+{
+    CHECK_RANGE_COVSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 4 +
+	    (y + fb->y) * fb->stride;
+
+    for (int i = 0; i < l; i++, pos += 4) {
+	const uint32_t a = cov[i];
+	if (0 == a)
+	    continue;
+	for (int c = 0; c < 3; c++) {
+	    const uint32_t s = (fb->fgcolor >> (8 * c)) & 0xff;
+	    fb->fbp[pos+c] = (uint8_t)blend8(fb->fbp[pos+c], s, a);
+	}
+	fb->fbp[pos+3] = 0xff;
+    }
+}
+
+/**
+ * @brief Blend the foreground color into the pixel at @p x and @p y
+ * The frame buffer has 1 bit per pixel, so alpha is thresholded
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param a alpha (0 … 255)
+ */
+static void blendpixel_1bpp(sfb_t* fb, int x, int y, uint32_t a)
+{
+    if (a >= 128)
+	setpixel_1bpp(fb, x, y);
+}
+
+/**
+ * @brief Blend the foreground color into the pixel at @p x and @p y
+ * The frame buffer has 8 bits per pixel (gray scale)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param a alpha (0 … 255)
+ */
+static void blendpixel_8bpp(sfb_t* fb, int x, int y, uint32_t a)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+
+    off_t pos =
+	    (x + fb->x) +
+	    (y + fb->y) * fb->stride;
+
+    fb->fbp[pos] = (uint8_t)blend8(fb->fbp[pos], fb->fgcolor & 0xff, a);
+}
+
+/**
+ * @brief Blend the foreground color into the pixel at @p x and @p y
+ * The frame buffer has 16 bits per pixel (RGB 5-6-5)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param a alpha (0 … 255)
+ */
+static void blendpixel_16bpp(sfb_t* fb, int x, int y, uint32_t a)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+
+    off_t pos =
+	    (x + fb->x) * 2 +
+	    (y + fb->y) * fb->stride;
+
+    const uint32_t p = fb->fbp[pos+0] | ((uint32_t)fb->fbp[pos+1] << 8);
+    const uint32_t q = blend565(p, fb->fgcolor, a);
+    fb->fbp[pos+0] = (uint8_t)(q >> 0);
+    fb->fbp[pos+1] = (uint8_t)(q >> 8);
+}
+
+/**
+ * @brief Blend the foreground color into the pixel at @p x and @p y
+ * The frame buffer has 24 bits per pixel (RGB 8-8-8)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param a alpha (0 … 255)
+ */
+static void blendpixel_24bpp(sfb_t* fb, int x, int y, uint32_t a)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+
+    off_t pos =
+	    (x + fb->x) * 3 +
+	    (y + fb->y) * fb->stride;
+
+    fb->fbp[pos+0] = (uint8_t)blend8(fb->fbp[pos+0], (fb->fgcolor >>  0) & 0xff, a);
+    fb->fbp[pos+1] = (uint8_t)blend8(fb->fbp[pos+1], (fb->fgcolor >>  8) & 0xff, a);
+    fb->fbp[pos+2] = (uint8_t)blend8(fb->fbp[pos+2], (fb->fgcolor >> 16) & 0xff, a);
+}
+
+/**
+ * @brief Blend the foreground color into the pixel at @p x and @p y
+ * The frame buffer has 32 bits per pixel (ARGB 8-8-8-8)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param a alpha (0 … 255)
+ */
+static void blendpixel_32bpp(sfb_t* fb, int x, int y, uint32_t a)
+{
+    CHECK_RANGE_SETPIXEL(fb);
+
+    off_t pos =
+	    (x + fb->x) * 4 +
+	    (y + fb->y) * fb->stride;
+
+    fb->fbp[pos+0] = (uint8_t)blend8(fb->fbp[pos+0], (fb->fgcolor >>  0) & 0xff, a);
+    fb->fbp[pos+1] = (uint8_t)blend8(fb->fbp[pos+1], (fb->fgcolor >>  8) & 0xff, a);
+    fb->fbp[pos+2] = (uint8_t)blend8(fb->fbp[pos+2], (fb->fgcolor >> 16) & 0xff, a);
+    fb->fbp[pos+3] = 0xff;
+}
+
+/**
+ * @brief Composite a premultiplied 8 bit channel @p s over @p d
+ * @param d destination channel value (0 … 255)
+ * @param s premultiplied source channel value (0 … 255)
+ * @param ia inverse source alpha (255 - alpha)
+ * @return composited channel value
+ */
+static inline uint32_t over8(uint32_t d, uint32_t s, uint32_t ia)
+{
+    const uint32_t t = d * ia + 128;
+    const uint32_t r = s + ((t + (t >> 8)) >> 8);
+    return r < 255 ? r : 255;
+}
+
+/**
+ * @brief Return the number of fully opaque pixels at the start of @p src
+ */
+static inline int opaque_run(const argb_t* src, int l)
+{
+    int n = 0;
+    while (n < l && 0xff000000u == (src[n] & 0xff000000u))
+	n++;
+    return n;
+}
+
+/**
+ * @brief Return the number of fully transparent pixels at the start of @p src
+ */
+static inline int transparent_run(const argb_t* src, int l)
+{
+    int n = 0;
+    while (n < l && 0 == (src[n] & 0xff000000u))
+	n++;
+    return n;
+}
+
+#if defined(SFB_SSE2)
+/**
+ * @brief Divide eight 16 bit products by 255 with rounding
+ */
+static inline __m128i div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/**
+ * @brief Composite four premultiplied ARGB pixels @p s over @p d
+ */
+static inline __m128i over_sse2(__m128i d, __m128i s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi16(255);
+    const __m128i slo = _mm_unpacklo_epi8(s, zero);
+    const __m128i shi = _mm_unpackhi_epi8(s, zero);
+    const __m128i ialo = _mm_sub_epi16(ff,
+	_mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xff), 0xff));
+    const __m128i iahi = _mm_sub_epi16(ff,
+	_mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xff), 0xff));
+    __m128i dlo = _mm_unpacklo_epi8(d, zero);
+    __m128i dhi = _mm_unpackhi_epi8(d, zero);
+    dlo = _mm_add_epi16(slo, div255_sse2(_mm_mullo_epi16(dlo, ialo)));
+    dhi = _mm_add_epi16(shi, div255_sse2(_mm_mullo_epi16(dhi, iahi)));
+    const __m128i r = _mm_or_si128(_mm_packus_epi16(dlo, dhi),
+	_mm_set1_epi32((int)0xff000000u));
+    /* leave fully transparent pixels, including their alpha byte, alone */
+    const __m128i skip = _mm_cmpeq_epi32(_mm_srli_epi32(s, 24), _mm_setzero_si128());
+    return _mm_or_si128(_mm_and_si128(skip, d), _mm_andnot_si128(skip, r));
+}
+#endif
+
+#if defined(SFB_NEON)
+/**
+ * @brief Divide eight 16 bit products by 255 with rounding
+ */
+static inline uint8x8_t div255_neon(uint16x8_t x)
+{
+    return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+#endif
+
+/**
+ * @brief check if coordinates x and y are in range
+ * adjust l and src if x < 0 or x + l > w
+ * 0 <= x < w and 0 <= y < h and l > 0
+ * otherwise return
+ */
+#define	CHECK_RANGE_BLENDSPAN(_fb) do {	\
+    if (x < 0) {			\
+	l += x;				\
+	src -= x;			\
+	x = 0;				\
+    }					\
+    if (x + l >= (_fb)->w) {		\
+	l = (_fb)->w - x;		\
+    }					\
+    if (l <= 0 ||			\
+	y < 0 ||			\
+	y >= (_fb)->h) {		\
+	return;				\
+    }					\
+} while (0)
+
+/**
+ * @brief Composite a row of premultiplied ARGB pixels (source over)
+ * The frame buffer has 1 bit per pixel, so alpha is thresholded
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param src array of @p l premultiplied ARGB pixels
+ * @param l length in pixels
+ */
+static void blendspan_1bpp(sfb_t* fb, int x, int y, const argb_t* src, int l)
+{
+    CHECK_RANGE_BLENDSPAN(fb);
+
+    const color_t fg = fb->fgcolor;
+    for (int i = 0; i < l; i++) {
+	const uint32_t a = src[i] >> 24;
+	if (a < 128)
+	    continue;
+	fb->fgcolor = rgb2pix_1bpp(
+	    (int)((src[i] >> 16) & 0xff) * 255 / (int)a,
+	    (int)((src[i] >>  8) & 0xff) * 255 / (int)a,
+	    (int)((src[i] >>  0) & 0xff) * 255 / (int)a);
+	setpixel_1bpp(fb, x + i, y);
+    }
+    fb->fgcolor = fg;
+}
+
+/**
+ * @brief Composite a row of premultiplied ARGB pixels (source over)
+ * The frame buffer has 8 bits per pixel (gray scale)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param src array of @p l premultiplied ARGB pixels
+ * @param l length in pixels
+ */
+static void blendspan_8bpp(sfb_t* fb, int x, int y, const argb_t* src, int l)
+{
+    CHECK_RANGE_BLENDSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) +
+	    (y + fb->y) * fb->stride;
+
+    for (int i = 0; i < l; i++, pos++) {
+	const uint32_t a = src[i] >> 24;
+	if (0 == a)
+	    continue;
+	const uint32_t s = rgb2pix_8bpp(
+	    (src[i] >> 16) & 0xff,
+	    (src[i] >>  8) & 0xff,
+	    (src[i] >>  0) & 0xff);
+	fb->fbp[pos] = (uint8_t)over8(fb->fbp[pos], s, 255 - a);
+    }
+}
+
+/**
+ * @brief Composite a row of premultiplied ARGB pixels (source over)
+ * The frame buffer has 16 bits per pixel (RGB 5-6-5)
+ *
+ * Runs of fully opaque pixels are converted and stored, runs of fully
+ * transparent pixels are skipped. Everything else is composited eight
+ * pixels at a time with SSE2 or NEON where available.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param src array of @p l premultiplied ARGB pixels
+ * @param l length in pixels
+ */
+static void blendspan_16bpp(sfb_t* fb, int x, int y, const argb_t* src, int l)
+{
+    CHECK_RANGE_BLENDSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 2 +
+	    (y + fb->y) * fb->stride;
+
+    int i = 0;
+    while (i < l) {
+	int n = transparent_run(src + i, l - i);
+	if (n) {
+	    i += n;
+	    pos += 2 * n;
+	    continue;
+	}
+	n = opaque_run(src + i, l - i);
+	for (int j = 0; j < n; j++, i++, pos += 2) {
+	    const uint32_t s = src[i];
+	    const uint32_t p = ((s >> 8) & 0xf800) | ((s >> 5) & 0x07e0) | ((s >> 3) & 0x001f);
+	    fb->fbp[pos+0] = (uint8_t)(p >> 0);
+	    fb->fbp[pos+1] = (uint8_t)(p >> 8);
+	}
+	if (n)
+	    continue;
+#if defined(SFB_SSE2)
+	if (l - i >= 8) {
+	    const __m128i s0 = _mm_loadu_si128((const __m128i *)(src + i));
+	    const __m128i s1 = _mm_loadu_si128((const __m128i *)(src + i + 4));
+	    const __m128i m8 = _mm_set1_epi32(0xff);
+	    const __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255),
+		_mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24)));
+	    const __m128i sr = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), m8),
+		_mm_and_si128(_mm_srli_epi32(s1, 16), m8));
+	    const __m128i sg = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), m8),
+		_mm_and_si128(_mm_srli_epi32(s1, 8), m8));
+	    const __m128i sb = _mm_packs_epi32(_mm_and_si128(s0, m8),
+		_mm_and_si128(s1, m8));
+	    const __m128i p = _mm_loadu_si128((const __m128i *)&fb->fbp[pos]);
+	    __m128i r = _mm_and_si128(_mm_srli_epi16(p, 8), _mm_set1_epi16(0xf8));
+	    __m128i g = _mm_and_si128(_mm_srli_epi16(p, 3), _mm_set1_epi16(0xfc));
+	    __m128i b = _mm_and_si128(_mm_slli_epi16(p, 3), _mm_set1_epi16(0xf8));
+	    r = _mm_or_si128(r, _mm_srli_epi16(r, 5));
+	    g = _mm_or_si128(g, _mm_srli_epi16(g, 6));
+	    b = _mm_or_si128(b, _mm_srli_epi16(b, 5));
+	    const __m128i max = _mm_set1_epi16(255);
+	    r = _mm_min_epi16(max, _mm_add_epi16(sr, div255_sse2(_mm_mullo_epi16(r, ia))));
+	    g = _mm_min_epi16(max, _mm_add_epi16(sg, div255_sse2(_mm_mullo_epi16(g, ia))));
+	    b = _mm_min_epi16(max, _mm_add_epi16(sb, div255_sse2(_mm_mullo_epi16(b, ia))));
+	    const __m128i q = _mm_or_si128(_mm_or_si128(
+		_mm_slli_epi16(_mm_srli_epi16(r, 3), 11),
+		_mm_slli_epi16(_mm_srli_epi16(g, 2), 5)),
+		_mm_srli_epi16(b, 3));
+	    _mm_storeu_si128((__m128i *)&fb->fbp[pos], q);
+	    i += 8;
+	    pos += 16;
+	    continue;
+	}
+#elif defined(SFB_NEON)
+	if (l - i >= 8) {
+	    const uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+	    const uint8x8_t ia = vmvn_u8(s.val[3]);
+	    const uint16x8_t p = vld1q_u16((const uint16_t *)&fb->fbp[pos]);
+	    uint8x8_t r = vand_u8(vshrn_n_u16(p, 8), vdup_n_u8(0xf8));
+	    uint8x8_t g = vand_u8(vshrn_n_u16(p, 3), vdup_n_u8(0xfc));
+	    uint8x8_t b = vmovn_u16(vshlq_n_u16(p, 3));
+	    r = vorr_u8(r, vshr_n_u8(r, 5));
+	    g = vorr_u8(g, vshr_n_u8(g, 6));
+	    b = vorr_u8(b, vshr_n_u8(b, 5));
+	    r = vqadd_u8(s.val[2], div255_neon(vmull_u8(r, ia)));
+	    g = vqadd_u8(s.val[1], div255_neon(vmull_u8(g, ia)));
+	    b = vqadd_u8(s.val[0], div255_neon(vmull_u8(b, ia)));
+	    uint16x8_t q = vshll_n_u8(r, 8);
+	    q = vsriq_n_u16(q, vshll_n_u8(g, 8), 5);
+	    q = vsriq_n_u16(q, vshll_n_u8(b, 8), 11);
+	    vst1q_u16((uint16_t *)&fb->fbp[pos], q);
+	    i += 8;
+	    pos += 16;
+	    continue;
+	}
+#endif
+	const uint32_t s = src[i];
+	const uint32_t ia = 255 - (s >> 24);
+	const uint32_t p = fb->fbp[pos+0] | ((uint32_t)fb->fbp[pos+1] << 8);
+	const uint32_t dr = ((p >> 8) & 0xf8) | ((p >> 13) & 0x07);
+	const uint32_t dg = ((p >> 3) & 0xfc) | ((p >>  9) & 0x03);
+	const uint32_t db = ((p << 3) & 0xf8) | ((p >>  2) & 0x07);
+	const uint32_t q = rgb2pix_16bpp(
+	    over8(dr, (s >> 16) & 0xff, ia),
+	    over8(dg, (s >>  8) & 0xff, ia),
+	    over8(db, (s >>  0) & 0xff, ia));
+	fb->fbp[pos+0] = (uint8_t)(q >> 0);
+	fb->fbp[pos+1] = (uint8_t)(q >> 8);
+	i++;
+	pos += 2;
+    }
+}
+
+/**
+ * @brief Composite a row of premultiplied ARGB pixels (source over)
+ * The frame buffer has 24 bits per pixel (RGB 8-8-8)
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param src array of @p l premultiplied ARGB pixels
+ * @param l length in pixels
+ */
+static void blendspan_24bpp(sfb_t* fb, int x, int y, const argb_t* src, int l)
+{
+    CHECK_RANGE_BLENDSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 3 +
+	    (y + fb->y) * fb->stride;
+
+    for (int i = 0; i < l; i++, pos += 3) {
+	const uint32_t s = src[i];
+	const uint32_t ia = 255 - (s >> 24);
+	if (255 == ia)
+	    continue;
+	fb->fbp[pos+0] = (uint8_t)over8(fb->fbp[pos+0], (s >>  0) & 0xff, ia);
+	fb->fbp[pos+1] = (uint8_t)over8(fb->fbp[pos+1], (s >>  8) & 0xff, ia);
+	fb->fbp[pos+2] = (uint8_t)over8(fb->fbp[pos+2], (s >> 16) & 0xff, ia);
+    }
+}
+
+/**
+ * @brief Composite a row of premultiplied ARGB pixels (source over)
+ * The frame buffer has 32 bits per pixel (ARGB 8-8-8-8)
+ *
+ * Runs of fully opaque pixels are copied, runs of fully transparent
+ * pixels are skipped. Everything else is composited four (SSE2) or
+ * eight (NEON) pixels at a time where available.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param src array of @p l premultiplied ARGB pixels
+ * @param l length in pixels
+ */
+static void blendspan_32bpp(sfb_t* fb, int x, int y, const argb_t* src, int l)
+{
+    CHECK_RANGE_BLENDSPAN(fb);
+
+    off_t pos =
+	    (x + fb->x) * 4 +
+	    (y + fb->y) * fb->stride;
+
+    int i = 0;
+    while (i < l) {
+	int n = transparent_run(src + i, l - i);
+	if (n) {
+	    i += n;
+	    pos += 4 * n;
+	    continue;
+	}
+	n = opaque_run(src + i, l - i);
+	if (n) {
+	    memcpy(&fb->fbp[pos], src + i, 4 * (size_t)n);
+	    i += n;
+	    pos += 4 * n;
+	    continue;
+	}
+#if defined(SFB_SSE2)
+	if (l - i >= 4) {
+	    const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+	    const __m128i d = _mm_loadu_si128((const __m128i *)&fb->fbp[pos]);
+	    _mm_storeu_si128((__m128i *)&fb->fbp[pos], over_sse2(d, s));
+	    i += 4;
+	    pos += 16;
+	    continue;
+	}
+#elif defined(SFB_NEON)
+	if (l - i >= 8) {
+	    const uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+	    uint8x8x4_t d = vld4_u8(&fb->fbp[pos]);
+	    const uint8x8_t ia = vmvn_u8(s.val[3]);
+	    d.val[0] = vqadd_u8(s.val[0], div255_neon(vmull_u8(d.val[0], ia)));
+	    d.val[1] = vqadd_u8(s.val[1], div255_neon(vmull_u8(d.val[1], ia)));
+	    d.val[2] = vqadd_u8(s.val[2], div255_neon(vmull_u8(d.val[2], ia)));
+	    d.val[3] = vorr_u8(d.val[3], vtst_u8(s.val[3], s.val[3]));
+	    vst4_u8(&fb->fbp[pos], d);
+	    i += 8;
+	    pos += 32;
+	    continue;
+	}
+#endif
+	const uint32_t s = src[i];
+	const uint32_t ia = 255 - (s >> 24);
+	fb->fbp[pos+0] = (uint8_t)over8(fb->fbp[pos+0], (s >>  0) & 0xff, ia);
+	fb->fbp[pos+1] = (uint8_t)over8(fb->fbp[pos+1], (s >>  8) & 0xff, ia);
+	fb->fbp[pos+2] = (uint8_t)over8(fb->fbp[pos+2], (s >> 16) & 0xff, ia);
+	fb->fbp[pos+3] = 0xff;
+	i++;
+	pos += 4;
+    }
+}
+
+/**
+ * @brief Fill a horizontal span with the current brush tile
+ *
+ * The tile rows are stored in frame buffer format and are at least
+ * 64 pixels wide, so a span is written with a few memcpy() of whole
+ * tile rows. At 1 bpp the tile holds one byte (0 or 1) per pixel.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param l length in pixels
+ */
+static void brushspan_copy(sfb_t* fb, int x, int y, int l)
+{
+    CHECK_RANGE_HLINE(fb);
+
+    int tx = (x - fb->brush_x) % fb->brush_w;
+    int ty = (y - fb->brush_y) % fb->brush_h;
+    if (tx < 0)
+	tx += fb->brush_w;
+    if (ty < 0)
+	ty += fb->brush_h;
+    const uint8_t* row = fb->brush + ty * fb->brush_stride;
+
+    if (1 == fb->bpp) {
+	const color_t fg = fb->fgcolor;
+	for (int i = 0; i < l; i++) {
+	    fb->fgcolor = row[tx];
+	    setpixel_1bpp(fb, x + i, y);
+	    if (++tx == fb->brush_w)
+		tx = 0;
+	}
+	fb->fgcolor = fg;
+	return;
+    }
+
+    const int bpx = fb->bpp / 8;
+    uint8_t* dst = &fb->fbp[(x + fb->x) * bpx + (y + fb->y) * fb->stride];
+    while (l > 0) {
+	const int n = MIN(l, fb->brush_w - tx);
+	memcpy(dst, row + tx * bpx, (size_t)(n * bpx));
+	dst += n * bpx;
+	l -= n;
+	tx = 0;
+    }
+}
+
+static void brush_stipple_build(sfb_t* fb);
+
+/**
+ * @brief Fill a horizontal span with the current stipple brush
+ *
+ * In opaque mode the clear bits are drawn in the background color and
+ * the span is copied from the tile, which is rebuilt if the colors
+ * changed. In transparent mode only runs of set bits are drawn.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x coordinate
+ * @param y coordinate
+ * @param l length in pixels
+ */
+static void brushspan_stipple(sfb_t* fb, int x, int y, int l)
+{
+    if (fb->opaque) {
+	if (fb->brush_fg != fb->fgcolor || fb->brush_bg != fb->bgcolor)
+	    brush_stipple_build(fb);
+	brushspan_copy(fb, x, y, l);
+	return;
+    }
+
+    CHECK_RANGE_HLINE(fb);
+    const uint8_t bits = fb->stipple[(y - fb->brush_y) & 7];
+    if (0xff == bits) {
+	fb->hline_copy(fb, x, y, l);
+	return;
+    }
+    for (int i = 0; i < l; ) {
+	const int b = (x + i - fb->brush_x) & 7;
+	if (!(bits & (0x80 >> b))) {
+	    i++;
+	    continue;
+	}
+	int n = 1;
+	while (i + n < l && (bits & (0x80 >> ((b + n) & 7))))
+	    n++;
+	fb->hline_copy(fb, x + i, y, n);
+	i += n;
+    }
+}
+
+/**
+ * @brief Draw a vertical line with the current brush
+ */
+static void fill_vline(sfb_t* fb, int x, int y, int l)
+{
+    if (fb->fillspan == fb->hline) {
+	fb->vline(fb, x, y, l);
+	return;
+    }
+    while (l-- > 0)
+	fb->fillspan(fb, x, y++, 1);
+}
+
+static void stroke_points(sfb_t* fb, const point_t* points, int n, int closed);
+static void fill_quad(sfb_t* fb, const int32_t* xy);
+
+/**
+ * @brief Classify the transform and derive its fixed point form
+ */
+static void xform_update(sfb_t* fb)
+{
+    const float* m = fb->xm;
+
+    for (int i = 0; i < 6; i++)
+	fb->xf[i] = (int32_t)lrintf(m[i] * 65536.0f);
+    /* pixel x, y has its center at x + 0.5, y + 0.5 */
+    fb->xc[0] = (int32_t)lrintf((m[2] + 0.5f * (m[0] + m[1]) - 0.5f) * 65536.0f);
+    fb->xc[1] = (int32_t)lrintf((m[5] + 0.5f * (m[3] + m[4]) - 0.5f) * 65536.0f);
+    if (1.0f == m[0] && 0.0f == m[1] && 0.0f == m[2] &&
+	0.0f == m[3] && 1.0f == m[4] && 0.0f == m[5])
+	fb->xform = XFORM_NONE;
+    else if (0.0f == m[1] && 0.0f == m[3])
+	fb->xform = XFORM_SCALE;
+    else
+	fb->xform = XFORM_AFFINE;
+    fb->xr = sqrtf(fabsf(m[0] * m[4] - m[1] * m[3]));
+    fb->xrx = hypotf(m[0], m[3]);
+    fb->xry = hypotf(m[1], m[4]);
+}
+
+/**
+ * @brief Map the center of pixel @p x, @p y to 16.16 device pixel coordinates
+ */
+static inline void xform_fixed(const sfb_t* fb, int x, int y, int64_t* fx, int64_t* fy)
+{
+    *fx = (int64_t)fb->xf[0] * x + (int64_t)fb->xf[1] * y + fb->xc[0];
+    *fy = (int64_t)fb->xf[3] * x + (int64_t)fb->xf[4] * y + fb->xc[1];
+}
+
+/**
+ * @brief Map pixel @p x, @p y to the nearest device pixel
+ */
+static inline void xform_point(const sfb_t* fb, int* x, int* y)
+{
+    int64_t fx, fy;
+    xform_fixed(fb, *x, *y, &fx, &fy);
+    *x = (int)((fx + 0x8000) >> 16);
+    *y = (int)((fy + 0x8000) >> 16);
+}
+
+/**
+ * @brief Map the pixel corner @p x, @p y to 16.16 device coordinates
+ */
+static inline void xform_corner(const sfb_t* fb, int x, int y, int32_t* fx, int32_t* fy)
+{
+    *fx = (int32_t)((int64_t)fb->xf[0] * x + (int64_t)fb->xf[1] * y + fb->xf[2]);
+    *fy = (int32_t)((int64_t)fb->xf[3] * x + (int64_t)fb->xf[4] * y + fb->xf[5]);
+}
+
+/**
+ * @brief Map the pixels @p x1, @p y1 to @p x2, @p y2 (inclusive) through a scale and translate transform
+ */
+static void xform_rect(const sfb_t* fb, int* x1, int* y1, int* x2, int* y2)
+{
+    int32_t ax, ay, bx, by;
+    xform_corner(fb, *x1, *y1, &ax, &ay);
+    xform_corner(fb, *x2 + 1, *y2 + 1, &bx, &by);
+    ax = (ax + 0x8000) >> 16;
+    ay = (ay + 0x8000) >> 16;
+    bx = (bx + 0x8000) >> 16;
+    by = (by + 0x8000) >> 16;
+    *x1 = MIN(ax, bx);
+    *y1 = MIN(ay, by);
+    *x2 = MAX(ax, bx) - 1;
+    *y2 = MAX(ay, by) - 1;
+}
+
+/**
+ * @brief Scale the length @p l by @p s and round it
+ */
+static inline int xform_len(float s, int l)
+{
+    return (int)(l * s + 0.5f);
+}
+
+/**
+ * @brief Device pixels of a rectangle mapped through the transform
+ *
+ * Without rotation or shear the rectangle maps to a rectangle and every
+ * row spans x1 … x2. Otherwise x1, y1 … x2, y2 bound the mapped
+ * quadrilateral, and @ref region_span() narrows each row to the pixels
+ * whose centers map back into the rectangle.
+ */
+typedef struct {
+    int x1, y1, x2, y2;		/*!< clipped device bounds, inclusive */
+    int affine;			/*!< rows are narrowed by the inverse mapping */
+    float u0, v0;		/*!< rectangle coordinates of device point 0, 0 */
+    float ux, vx;		/*!< their change per device pixel in x */
+    float uy, vy;		/*!< their change per device pixel in y */
+    float w, h;			/*!< size of the rectangle */
+}   region_t;
+
+/**
+ * @brief Map the pixels @p x1, @p y1 to @p x2, @p y2 (inclusive) to @p rg
+ *
+ * @return non-zero if any pixel of the frame buffer may be covered
+ */
+static int region_init(const sfb_t* fb, region_t* rg, int x1, int y1, int x2, int y2)
+{
+    int tl_x = MIN(x1, x2);
+    int tl_y = MIN(y1, y2);
+    int br_x = MAX(x1, x2);
+    int br_y = MAX(y1, y2);
+
+    rg->affine = XFORM_AFFINE == fb->xform;
+    if (rg->affine) {
+	const float* m = fb->xm;
+	const float det = m[0] * m[4] - m[1] * m[3];
+	if (0.0f == det)
+	    return 0;
+	float bx0 = (float)fb->w, by0 = (float)fb->h, bx1 = -1.0f, by1 = -1.0f;
+	for (int i = 0; i < 4; i++) {
+	    const float cx = (float)((i & 1) ? br_x + 1 : tl_x);
+	    const float cy = (float)((i & 2) ? br_y + 1 : tl_y);
+	    const float dx = m[0] * cx + m[1] * cy + m[2];
+	    const float dy = m[3] * cx + m[4] * cy + m[5];
+	    bx0 = MIN(bx0, dx);
+	    by0 = MIN(by0, dy);
+	    bx1 = MAX(bx1, dx);
+	    by1 = MAX(by1, dy);
+	}
+	rg->x1 = (int)floorf(BOUND(bx0, -1.0f, (float)fb->w));
+	rg->y1 = (int)floorf(BOUND(by0, -1.0f, (float)fb->h));
+	rg->x2 = (int)ceilf(BOUND(bx1, -1.0f, (float)fb->w));
+	rg->y2 = (int)ceilf(BOUND(by1, -1.0f, (float)fb->h));
+	/* inverse mapping of device pixel centers, relative to the corner */
+	rg->ux = m[4] / det;
+	rg->uy = -m[1] / det;
+	rg->vx = -m[3] / det;
+	rg->vy = m[0] / det;
+	const float ox = 0.5f - m[2];
+	const float oy = 0.5f - m[5];
+	rg->u0 = rg->ux * ox + rg->uy * oy - (float)tl_x;
+	rg->v0 = rg->vx * ox + rg->vy * oy - (float)tl_y;
+	rg->w = (float)(br_x + 1 - tl_x);
+	rg->h = (float)(br_y + 1 - tl_y);
+    } else {
+	if (fb->xform)
+	    xform_rect(fb, &tl_x, &tl_y, &br_x, &br_y);
+	rg->x1 = tl_x;
+	rg->y1 = tl_y;
+	rg->x2 = br_x;
+	rg->y2 = br_y;
+    }
+    rg->x1 = MAX(0, rg->x1);
+    rg->y1 = MAX(0, rg->y1);
+    rg->x2 = MIN(fb->w - 1, rg->x2);
+    rg->y2 = MIN(fb->h - 1, rg->y2);
+    return rg->x1 <= rg->x2 && rg->y1 <= rg->y2;
+}
+
+/**
+ * @brief Narrow the span @p x1 … @p x2 to where t0 + x * dt lies in [0, @p hi)
+ */
+static void region_clip(float t0, float dt, float hi, int* x1, int* x2)
+{
+    float a, b;
+
+    if (0.0f == dt) {
+	if (t0 < 0.0f || t0 >= hi)
+	    *x2 = *x1 - 1;
+	return;
+    }
+    if (dt > 0.0f) {
+	a = ceilf(-t0 / dt);
+	b = ceilf((hi - t0) / dt) - 1.0f;
+    } else {
+	a = floorf((hi - t0) / dt) + 1.0f;
+	b = floorf(-t0 / dt);
+    }
+    if (a > (float)*x1)
+	*x1 = a > (float)*x2 ? *x2 + 1 : (int)a;
+    if (b < (float)*x2)
+	*x2 = b < (float)*x1 ? *x1 - 1 : (int)b;
+}
+
+/**
+ * @brief Set @p x1 … @p x2 to the pixels of @p rg on row @p y (empty if @p x2 < @p x1)
+ */
+static void region_span(const region_t* rg, int y, int* x1, int* x2)
+{
+    *x1 = rg->x1;
+    *x2 = rg->x2;
+    if (rg->affine) {
+	region_clip(rg->u0 + rg->uy * y, rg->ux, rg->w, x1, x2);
+	region_clip(rg->v0 + rg->vy * y, rg->vx, rg->h, x1, x2);
+    }
+}
+
+/**
+ * @brief Set the pixel at @p x, @p y mapped through the transform
+ */
+static void plot(sfb_t* fb, int x, int y)
+{
+    if (fb->xform)
+	xform_point(fb, &x, &y);
+    fb->setpixel(fb, x, y);
+}
+
+/**
+ * @brief Draw a one pixel wide line in device coordinates with the kernel @p setpixel
+ */
+static void line_dev(sfb_t *fb, int x1, int y1, int x2, int y2, void (*setpixel)(sfb_t*, int, int))
+{
+    const int sx = x1 < x2 ? 1 : -1;
+    const int sy = y1 < y2 ? 1 : -1;
+    const int dx = abs(x2 - x1);
+    const int dy = abs(y2 - y1);
+
+    if (dx >= dy) {
+	// Loop for x coordinates
+	int dda = dx / 2;
+	while (x1 != x2) {
+	    setpixel(fb, x1, y1);
+	    x1 += sx;
+	    dda -= dy;
+	    if (dda <= 0) {
+		y1 += sy;
+		dda += dx;
+	    }
+	}
+    } else {
+	// Loop for y coordinates
+	int dda = dy / 2;
+	while (y1 != y2) {
+	    setpixel(fb, x1, y1);
+	    y1 += sy;
+	    dda -= dx;
+	    if (dda <= 0) {
+		x1 += sx;
+		dda += dy;
+	    }
+	}
+    }
+}
+
+/**
+ * @brief Draw a line from @p x1, @p y1 to @p x2, @p y2
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 line start x coordinate
+ * @param y1 line start y coordinate
+ * @param x2 line end x coordinate
+ * @param y2 line end y coordinate
+ */
+void fb_line(sfb_t *fb, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    if (1.0f != fb->line_width || fb->ndash) {
+	const point_t pt[2] = { { x1, y1 }, { x2, y2 } };
+	stroke_points(fb, pt, 2, 0);
+	return;
+    }
+    if (fb->xform) {
+	xform_point(fb, &x1, &y1);
+	xform_point(fb, &x2, &y2);
+    }
+    line_dev(fb, x1, y1, x2, y2, fb->setpixel);
+}
+
+/**
+ * @brief Plot points in the order given by @p order (or as they are)
+ *
+ * If @p map is non-zero, each point is mapped through the transform
+ * here, so the caller's array is left alone. Clipping is one unsigned
+ * compare per coordinate. With the copy raster operation the pixels
+ * are stored directly for the depth, otherwise they go through the
+ * setpixel kernel.
+ */
+static void points_plot(sfb_t* fb, const point_t* pt, int n, const color_t* colors, const int* order,
+	int map)
+{
+    const unsigned w = (unsigned)fb->w;
+    const unsigned h = (unsigned)fb->h;
+    const color_t fg = fb->fgcolor;
+
+    if (rop_copy != fb->rop || 1 == fb->bpp) {
+	for (int i = 0; i < n; i++) {
+	    const int j = order ? order[i] : i;
+	    int x = pt[j].x;
+	    int y = pt[j].y;
+	    if (map)
+		xform_point(fb, &x, &y);
+	    if ((unsigned)x >= w || (unsigned)y >= h)
+		continue;
+	    if (colors)
+		fb->fgcolor = colors[j];
+	    fb->setpixel(fb, x, y);
+	}
+	fb->fgcolor = fg;
+	return;
+    }
+
+    const int bpx = fb->bpp / 8;
+    uint8_t* base = fb->fbp + fb->x * bpx + fb->y * fb->stride;
+    for (int i = 0; i < n; i++) {
+	const int j = order ? order[i] : i;
+	int x = pt[j].x;
+	int y = pt[j].y;
+	if (map)
+	    xform_point(fb, &x, &y);
+	if ((unsigned)x >= w || (unsigned)y >= h)
+	    continue;
+	const color_t c = colors ? colors[j] : fg;
+	uint8_t* dst = base + y * fb->stride + x * bpx;
+	switch (bpx) {
+	case 4:
+	    dst[3] = (uint8_t)(c >> 24);
+	    /* fall through */
+	case 3:
+	    dst[2] = (uint8_t)(c >> 16);
+	    /* fall through */
+	case 2:
+	    dst[1] = (uint8_t)(c >> 8);
+	    /* fall through */
+	default:
+	    dst[0] = (uint8_t)c;
+	}
+    }
+}
+
+/**
+ * @brief Plot @p n points
+ *
+ * This is much cheaper than calling @ref fb_setpixel() per point: the
+ * context is checked once, clipping is one unsigned compare per
+ * coordinate and the pixels are stored without a kernel call.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of @p n points
+ * @param n number of points
+ * @param colors array of @p n pixel values, or NULL for the foreground color
+ */
+void fb_points(sfb_t* fb, const point_t* points, int n, const color_t* colors)
+{
+    CHECK_FB(fb);
+    if (!points || n <= 0)
+	return;
+    points_plot(fb, points, n, colors, NULL, fb->xform);
+}
+
+/**
+ * @brief Plot @p n points in row order
+ *
+ * The points are counting sorted by row first (clipped rows are
+ * dropped on the way), which keeps the writes within few cache lines
+ * and pages. This pays off on deferred I/O frame buffers and for large
+ * scattered sets. Points on the same row keep their order. Under a
+ * transform the points are mapped once into a temporary array.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of @p n points
+ * @param n number of points
+ * @param colors array of @p n pixel values, or NULL for the foreground color
+ */
+void fb_points_sorted(sfb_t* fb, const point_t* points, int n, const color_t* colors)
+{
+    CHECK_FB(fb);
+    if (!points || n <= 0)
+	return;
+    int* count = (int *)calloc(fb->h + 1, sizeof(int));
+    int* order = (int *)malloc(n * sizeof(int));
+    point_t* dev = fb->xform ? (point_t *)malloc(n * sizeof(point_t)) : NULL;
+    if (!count || !order || (fb->xform && !dev)) {
+	error(fb, "Error: insufficient memory for %d points", n);
+	free(dev);
+	free(order);
+	free(count);
+	return;
+    }
+    if (dev) {
+	for (int i = 0; i < n; i++) {
+	    dev[i] = points[i];
+	    xform_point(fb, &dev[i].x, &dev[i].y);
+	}
+	points = dev;
+    }
+
+    for (int i = 0; i < n; i++)
+	if ((unsigned)points[i].y < (unsigned)fb->h)
+	    count[points[i].y + 1]++;
+    for (int y = 0; y < fb->h; y++)
+	count[y + 1] += count[y];
+    const int m = count[fb->h];
+    for (int i = 0; i < n; i++)
+	if ((unsigned)points[i].y < (unsigned)fb->h)
+	    order[count[points[i].y]++] = i;
+    points_plot(fb, points, m, colors, order, 0);
+
+    free(dev);
+    free(order);
+    free(count);
+}
+
+/**
+ * @brief Draw an anti-aliased line from @p x1, @p y1 to @p x2, @p y2
+ *
+ * Xiaolin Wu's algorithm with a 16 bit fractional error accumulator:
+ * each step along the major axis blends the foreground color into the
+ * two pixels straddling the ideal line, weighted by their distance.
+ * Like @ref fb_line() the end point itself is not drawn, so lines of
+ * a polyline do not blend their shared vertices twice.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 line start x coordinate
+ * @param y1 line start y coordinate
+ * @param x2 line end x coordinate
+ * @param y2 line end y coordinate
+ */
+void fb_aaline(sfb_t *fb, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    if (fb->xform) {
+	xform_point(fb, &x1, &y1);
+	xform_point(fb, &x2, &y2);
+    }
+    const int sx = x1 < x2 ? 1 : -1;
+    const int sy = y1 < y2 ? 1 : -1;
+    int dx = abs(x2 - x1);
+    int dy = abs(y2 - y1);
+
+    if (0 == dy || 0 == dx || dx == dy) {
+	/* horizontal, vertical and diagonal lines need no blending */
+	line_dev(fb, x1, y1, x2, y2, fb->setpixel_copy);
+	return;
+    }
+
+    fb->setpixel_copy(fb, x1, y1);
+    uint16_t acc = 0;
+    if (dx > dy) {
+	/* x major: the fraction of y moves between two rows */
+	const uint16_t adj = (uint16_t)(((uint32_t)dy << 16) / dx);
+	while (--dx > 0) {
+	    const uint16_t prev = acc;
+	    acc += adj;
+	    if (acc <= prev)
+		y1 += sy;
+	    x1 += sx;
+	    const uint32_t w = acc >> 8;
+	    fb->blendpixel(fb, x1, y1, w ^ 0xff);
+	    fb->blendpixel(fb, x1, y1 + sy, w);
+	}
+    } else {
+	/* y major: the fraction of x moves between two columns */
+	const uint16_t adj = (uint16_t)(((uint32_t)dx << 16) / dy);
+	while (--dy > 0) {
+	    const uint16_t prev = acc;
+	    acc += adj;
+	    if (acc <= prev)
+		x1 += sx;
+	    y1 += sy;
+	    const uint32_t w = acc >> 8;
+	    fb->blendpixel(fb, x1, y1, w ^ 0xff);
+	    fb->blendpixel(fb, x1 + sx, y1, w);
+	}
+    }
+}
+
+/**
+ * @brief Draw a rectangle at @p x1, @p y1 to @p x2, @p y2
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ */
+void fb_rect(sfb_t *fb, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    int tl_x = x1 <= x2 ? x1 : x2;
+    int tl_y = y1 <= y2 ? y1 : y2;
+    int br_x = x1 > x2 ? x1 : x2;
+    int br_y = y1 > y2 ? y1 : y2;
+
+    if (1.0f != fb->line_width || fb->ndash) {
+	const point_t pt[4] = { { tl_x, tl_y }, { br_x, tl_y }, { br_x, br_y }, { tl_x, br_y } };
+	stroke_points(fb, pt, 4, 1);
+	return;
+    }
+    if (XFORM_AFFINE == fb->xform) {
+	const point_t pt[4] = { { tl_x, tl_y }, { br_x, tl_y }, { br_x, br_y }, { tl_x, br_y } };
+	fb_polygon(fb, pt, 4);
+	return;
+    }
+    if (fb->xform)
+	xform_rect(fb, &tl_x, &tl_y, &br_x, &br_y);
+
+    const int w = br_x + 1 - tl_x;
+    const int h = br_y + 1 - tl_y;
+
+    /* every pixel once, so XOR rectangles keep their corners */
+    fb->hline(fb, tl_x, tl_y, w);
+    if (h > 1)
+	fb->hline(fb, tl_x, br_y, w);
+    if (h > 2) {
+	fb->vline(fb, tl_x, tl_y + 1, h - 2);
+	if (w > 1)
+	    fb->vline(fb, br_x, tl_y + 1, h - 2);
+    }
+}
+
+/**
+ * @brief Fill a rectangle at @p x1, @p y1 to @p x2, @p y2
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ */
+void fb_fill(sfb_t *fb, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    int tl_x = x1 <= x2 ? x1 : x2;
+    int tl_y = y1 <= y2 ? y1 : y2;
+    int br_x = x1 > x2 ? x1 : x2;
+    int br_y = y1 > y2 ? y1 : y2;
+
+    if (XFORM_AFFINE == fb->xform) {
+	int32_t xy[8];
+	xform_corner(fb, tl_x, tl_y, &xy[0], &xy[1]);
+	xform_corner(fb, br_x + 1, tl_y, &xy[2], &xy[3]);
+	xform_corner(fb, br_x + 1, br_y + 1, &xy[4], &xy[5]);
+	xform_corner(fb, tl_x, br_y + 1, &xy[6], &xy[7]);
+	fill_quad(fb, xy);
+	return;
+    }
+    if (fb->xform)
+	xform_rect(fb, &tl_x, &tl_y, &br_x, &br_y);
+
+    const int w = br_x + 1 - tl_x;
+    const int h = br_y + 1 - tl_y;
+
+    for (int i = 0; i < h; i++)
+	fb->fillspan(fb, tl_x, tl_y + i, w);
+}
+
+/**
+ * @brief Composite an image of premultiplied ARGB pixels at @p x, @p y
+ *
+ * The pixels are composited source over the frame buffer. Fully
+ * opaque and fully transparent runs take a fast path, so images with
+ * large solid or empty areas cost little more than a plain copy.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x top left x coordinate
+ * @param y top left y coordinate
+ * @param src pointer to the premultiplied ARGB 8-8-8-8 pixels
+ * @param w width of the image in pixels
+ * @param h height of the image in pixels
+ * @param stride distance between rows of @p src in pixels
+ */
+void fb_blit_blend(sfb_t* fb, int x, int y, const argb_t* src, int w, int h, int stride)
+{
+    CHECK_FB(fb);
+    if (!src || w <= 0 || h <= 0)
+	return;
+    const int y0 = MAX(0, -y);
+    const int y1 = MIN(h, fb->h - y);
+    for (int i = y0; i < y1; i++)
+	fb->blendspan(fb, x, y + i, src + (size_t)i * stride, w);
+}
+
+/**
+ * @brief Convert a gd true color pixel to premultiplied ARGB
+ *
+ * gd stores a 7 bit alpha, 0 opaque to 127 transparent, which is
+ * scaled to 8 bits before the channels are premultiplied.
+ */
+static inline argb_t gd_argb(int pix)
+{
+    const uint32_t a = ((gdAlphaMax - gdTrueColorGetAlpha(pix)) * 255 + gdAlphaMax / 2) / gdAlphaMax;
+    if (255 == a)
+	return 0xff000000u | ((argb_t)pix & 0xffffff);
+    uint32_t t;
+    t = gdTrueColorGetRed(pix) * a + 128;
+    const uint32_t r = (t + (t >> 8)) >> 8;
+    t = gdTrueColorGetGreen(pix) * a + 128;
+    const uint32_t g = (t + (t >> 8)) >> 8;
+    t = gdTrueColorGetBlue(pix) * a + 128;
+    const uint32_t b = (t + (t >> 8)) >> 8;
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/**
+ * @brief Composite a gd image at @p x, @p y using its alpha channel
+ *
+ * Unlike @ref fb_dump() and @ref fb_sprite_init_gd(), which keep only
+ * opaque or transparent pixels, the gd alpha is honored in full: each
+ * visible row is converted to premultiplied ARGB and composited with
+ * the same kernels as @ref fb_blit_blend(). Pixels with the image's
+ * transparent color are skipped.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x top left x coordinate
+ * @param y top left y coordinate
+ * @param im gdImagePtr with the image to composite
+ */
+void fb_blit_gd(sfb_t* fb, int x, int y, gdImagePtr im)
+{
+    CHECK_FB(fb);
+    if (!im)
+	return;
+    const int key = gdImageGetTransparent(im);
+    const int x0 = MAX(0, -x);
+    const int x1 = MIN(gdImageSX(im), fb->w - x);
+    const int y0 = MAX(0, -y);
+    const int y1 = MIN(gdImageSY(im), fb->h - y);
+    argb_t row[256];
+
+    for (int i = y0; i < y1; i++) {
+	for (int j = x0; j < x1; j += 256) {
+	    const int n = MIN(x1 - j, 256);
+	    for (int k = 0; k < n; k++) {
+		const int pix = gdImageGetTrueColorPixel(im, j + k, i);
+		row[k] = key >= 0 && gdImageTrueColor(im) && pix == key ? 0 : gd_argb(pix);
+	    }
+	    fb->blendspan(fb, x + j, y + i, row, n);
+	}
+    }
+}
+
+/**
+ * @brief Composite the premultiplied ARGB color @p argb over a rectangle
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param argb premultiplied ARGB 8-8-8-8 color
+ */
+void fb_blend_rect(sfb_t *fb, int x1, int y1, int x2, int y2, argb_t argb)
+{
+    CHECK_FB(fb);
+    region_t rg;
+    argb_t row[256];
+
+    if (0 == (argb >> 24) || !region_init(fb, &rg, x1, y1, x2, y2))
+	return;
+    for (int i = 0; i < MIN(rg.x2 + 1 - rg.x1, 256); i++)
+	row[i] = argb;
+    for (int y = rg.y1; y <= rg.y2; y++) {
+	int tl_x, br_x;
+	region_span(&rg, y, &tl_x, &br_x);
+	for (int x = tl_x; x <= br_x; x += 256)
+	    fb->blendspan(fb, x, y, row, MIN(br_x + 1 - x, 256));
+    }
+}
+
+/**
+ * @brief Rebuild the nibble lookup table for the current colors
+ *
+ * Entry n holds four pixels in frame buffer format: the foreground
+ * color for the set bits of n (most significant bit first), the
+ * background color for the others.
+ */
+static void bitmap_lut(sfb_t* fb)
+{
+    const int bpx = fb->bpp / 8;
+    if (fb->lut_valid && fb->lut_fg == fb->fgcolor && fb->lut_bg == fb->bgcolor)
+	return;
+    for (int n = 0; n < 16; n++) {
+	for (int i = 0; i < 4; i++) {
+	    const color_t c = (n & (8 >> i)) ? fb->fgcolor : fb->bgcolor;
+	    for (int b = 0; b < bpx; b++)
+		fb->lut[n][i * bpx + b] = (uint8_t)(c >> (8 * b));
+	}
+    }
+    fb->lut_fg = fb->fgcolor;
+    fb->lut_bg = fb->bgcolor;
+    fb->lut_valid = 1;
+}
+
+/**
+ * @brief Return @p k (1 … 4) bits of @p row starting at bit @p o as a nibble
+ *
+ * The bits are aligned to the most significant end of the nibble, the
+ * unused low bits are zero. No byte beyond the last needed bit is read.
+ */
+static inline uint32_t bitmap_nibble(const uint8_t* row, int o, int k)
+{
+    const int shift = o & 7;
+    uint32_t v = (uint32_t)row[o >> 3] << 8;
+    if (shift + k > 8)
+	v |= row[(o >> 3) + 1];
+    return (v >> (12 - shift)) & (0xf0u >> k) & 0xf;
+}
+
+/**
+ * @brief Expand a 1 bpp bitmap to the frame buffer at @p x, @p y
+ *
+ * Set bits are drawn in the foreground color, clear bits in the
+ * background color in opaque mode and not at all in transparent mode.
+ * Four pixels at a time are copied from the nibble lookup table. With
+ * a raster operation other than copy, and at 1 bpp, the pixels go
+ * through the setpixel kernel.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x left x coordinate
+ * @param y top y coordinate
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param bits bitmap rows, most significant bit first
+ * @param stride distance between rows of @p bits in bytes
+ */
+static void bitmap_blit(sfb_t* fb, int x, int y, int w, int h, const uint8_t* bits, int stride)
+{
+    int sx = 0, sy = 0;
+    if (x < 0) {
+	sx = -x;
+	w += x;
+	x = 0;
+    }
+    if (y < 0) {
+	sy = -y;
+	h += y;
+	y = 0;
+    }
+    w = MIN(w, fb->w - x);
+    h = MIN(h, fb->h - y);
+    if (w <= 0 || h <= 0)
+	return;
+
+    if (1 == fb->bpp || rop_copy != fb->rop) {
+	for (int j = 0; j < h; j++) {
+	    const uint8_t* row = bits + (sy + j) * stride;
+	    for (int i = 0; i < w; i++) {
+		const int o = sx + i;
+		if (row[o >> 3] & (0x80 >> (o & 7))) {
+		    fb->setpixel(fb, x + i, y + j);
+		} else if (fb->opaque) {
+		    swap_fg_bg(fb);
+		    fb->setpixel(fb, x + i, y + j);
+		    swap_fg_bg(fb);
+		}
+	    }
+	}
+	return;
+    }
+
+    const int bpx = fb->bpp / 8;
+    bitmap_lut(fb);
+    const uint8_t* fg = fb->lut[15];
+    for (int j = 0; j < h; j++) {
+	const uint8_t* row = bits + (sy + j) * stride;
+	uint8_t* dst = &fb->fbp[(x + fb->x) * bpx + (y + j + fb->y) * fb->stride];
+	for (int i = 0; i < w; i += 4, dst += 4 * bpx) {
+	    const int k = MIN(4, w - i);
+	    const uint32_t nib = bitmap_nibble(row, sx + i, k);
+	    if (fb->opaque) {
+		memcpy(dst, fb->lut[nib], (size_t)(k * bpx));
+		continue;
+	    }
+	    if (0 == nib)
+		continue;
+	    if (0xf == nib) {
+		memcpy(dst, fg, (size_t)(4 * bpx));
+		continue;
+	    }
+	    for (int b = 0; b < k; b++)
+		if (nib & (8 >> b))
+		    memcpy(dst + b * bpx, fg, (size_t)bpx);
+	}
+    }
+}
+
+/**
+ * @brief Draw a monochrome bitmap at @p x, @p y
+ *
+ * Set bits are drawn in the foreground color. Clear bits are drawn in
+ * the background color in opaque mode (see @ref fb_set_opaque()) and
+ * are transparent otherwise. Text uses the same code path.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x left x coordinate
+ * @param y top y coordinate
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param bits bitmap rows, most significant bit is the leftmost pixel
+ * @param stride distance between rows of @p bits in bytes
+ */
+void fb_bitmap(sfb_t* fb, int x, int y, int w, int h, const unsigned char* bits, int stride)
+{
+    CHECK_FB(fb);
+    if (!bits || w <= 0 || h <= 0)
+	return;
+    bitmap_blit(fb, x, y, w, h, bits, stride);
+}
+
+/**
+ * @brief A sprite in frame buffer format with run length encoded transparency
+ *
+ * Each row is a sequence of runs: a header of two uint16_t, the number
+ * of transparent pixels to skip and the number of opaque pixels that
+ * follow, then the opaque pixels in frame buffer format. A run with
+ * zero opaque pixels ends the row.
+ */
+typedef struct sfb_sprite_s {
+    int w;			/*!< width in pixels */
+    int h;			/*!< height in pixels */
+    int bpp;			/*!< depth of the frame buffer the sprite was made for */
+    size_t* row;		/*!< offset of every row in data */
+    uint8_t* data;		/*!< encoded rows */
+}   sfb_sprite_t;
+
+/**
+ * @brief Append a run header to the sprite data (or just count it if @p dst is NULL)
+ */
+static size_t sprite_run(uint8_t* dst, size_t pos, int skip, int len)
+{
+    if (dst) {
+	const uint16_t hdr[2] = { (uint16_t)skip, (uint16_t)len };
+	memcpy(dst + pos, hdr, sizeof(hdr));
+    }
+    return pos + 2 * sizeof(uint16_t);
+}
+
+/**
+ * @brief Encode the ARGB image @p src into @p spr, or compute the size if @p spr->data is NULL
+ * @return size of the encoded data in bytes
+ */
+static size_t sprite_encode(sfb_t* fb, sfb_sprite_t* spr, const argb_t* src, int stride)
+{
+    const int bpx = 1 == fb->bpp ? 1 : fb->bpp / 8;
+    uint8_t* dst = spr->data;
+    size_t pos = 0;
+
+    for (int j = 0; j < spr->h; j++) {
+	const argb_t* s = src + (size_t)j * stride;
+	if (dst)
+	    spr->row[j] = pos;
+	int i = 0;
+	while (i < spr->w) {
+	    int skip = 0, len = 0;
+	    while (i < spr->w && (s[i] >> 24) < 128 && skip < 0xffff)
+		i++, skip++;
+	    while (i + len < spr->w && (s[i + len] >> 24) >= 128 && len < 0xffff)
+		len++;
+	    if (0 == len)
+		continue;
+	    pos = sprite_run(dst, pos, skip, len);
+	    for (int k = 0; k < len; k++, i++) {
+		const color_t c = fb->rgb2pix((s[i] >> 16) & 0xff, (s[i] >> 8) & 0xff, s[i] & 0xff);
+		if (dst)
+		    for (int b = 0; b < bpx; b++)
+			dst[pos + b] = (uint8_t)(c >> (8 * b));
+		pos += bpx;
+	    }
+	}
+	pos = sprite_run(dst, pos, 0, 0);
+    }
+    return pos;
+}
+
+/**
+ * @brief Create a sprite from an ARGB 8-8-8-8 image
+ *
+ * The pixels are converted to the format of the frame buffer @p fb
+ * once. Pixels with an alpha below 128 are transparent, all others
+ * opaque.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param psprite pointer to the sprite pointer to set
+ * @param src pointer to the ARGB pixels
+ * @param w width in pixels
+ * @param h height in pixels
+ * @param stride distance between rows of @p src in pixels
+ * @return 0 on success, or < 0 on error
+ */
+int fb_sprite_init(sfb_t* fb, struct sfb_sprite_s** psprite, const argb_t* src, int w, int h, int stride)
+{
+    CHECK_FB_RET(fb, -1);
+    if (!psprite)
+	return -1;
+    *psprite = NULL;
+    if (!src || w <= 0 || h <= 0)
+	return -1;
+
+    sfb_sprite_t* spr = (sfb_sprite_t *)calloc(1, sizeof(sfb_sprite_t));
+    if (!spr)
+	return -1;
+    spr->w = w;
+    spr->h = h;
+    spr->bpp = fb->bpp;
+    const size_t size = sprite_encode(fb, spr, src, stride);
+    spr->row = (size_t *)malloc(h * sizeof(size_t));
+    spr->data = (uint8_t *)malloc(size);
+    if (!spr->row || !spr->data) {
+	error(fb, "Error: insufficient memory for a %dx%d sprite", w, h);
+	fb_sprite_exit(&spr);
+	return -1;
+    }
+    sprite_encode(fb, spr, src, stride);
+    *psprite = spr;
+    return 0;
+}
+
+/**
+ * @brief Create a sprite from a gd image
+ *
+ * Pixels that are more than half transparent (gd alpha above 63) or
+ * have the image's transparent color are transparent.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param psprite pointer to the sprite pointer to set
+ * @param im gdImagePtr with the image to convert
+ * @return 0 on success, or < 0 on error
+ */
+int fb_sprite_init_gd(sfb_t* fb, struct sfb_sprite_s** psprite, gdImagePtr im)
+{
+    CHECK_FB_RET(fb, -1);
+    if (!psprite)
+	return -1;
+    *psprite = NULL;
+    if (!im)
+	return -1;
+
+    const int w = gdImageSX(im);
+    const int h = gdImageSY(im);
+    const int key = gdImageGetTransparent(im);
+    argb_t* argb = (argb_t *)malloc((size_t)w * h * sizeof(argb_t));
+    if (!argb) {
+	error(fb, "Error: insufficient memory for a %dx%d sprite", w, h);
+	return -1;
+    }
+    for (int y = 0; y < h; y++) {
+	for (int x = 0; x < w; x++) {
+	    const int pix = gdImageGetTrueColorPixel(im, x, y);
+	    const int transparent = gdTrueColorGetAlpha(pix) > gdAlphaMax / 2 ||
+		(key >= 0 && gdImageTrueColor(im) && pix == key);
+	    argb[y * w + x] = (transparent ? 0 : 0xff000000u) | ((argb_t)pix & 0xffffff);
+	}
+    }
+    const int res = fb_sprite_init(fb, psprite, argb, w, h, w);
+    free(argb);
+    return res;
+}
+
+/**
+ * @brief Free a sprite
+ * @param psprite pointer to the sprite pointer to free and reset
+ */
+void fb_sprite_exit(struct sfb_sprite_s** psprite)
+{
+    if (!psprite || !*psprite)
+	return;
+    sfb_sprite_t* spr = *psprite;
+    *psprite = NULL;
+    free(spr->data);
+    free(spr->row);
+    free(spr);
+}
+
+/**
+ * @brief Draw a sprite at @p x, @p y
+ *
+ * Transparent runs are skipped, opaque runs are copied with memcpy().
+ * The sprite must have been created for a frame buffer of the same
+ * depth.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param spr pointer to the sprite
+ * @param x left x coordinate
+ * @param y top y coordinate
+ */
+void fb_sprite_blit(sfb_t* fb, const struct sfb_sprite_s* spr, int x, int y)
+{
+    CHECK_FB(fb);
+    if (!spr)
+	return;
+    if (spr->bpp != fb->bpp) {
+	error(fb, "Error: sprite depth %d does not match the frame buffer (%d)", spr->bpp, fb->bpp);
+	return;
+    }
+
+    const int bpx = 1 == fb->bpp ? 1 : fb->bpp / 8;
+    const int j0 = MAX(0, -y);
+    const int j1 = MIN(spr->h, fb->h - y);
+    const color_t fg = fb->fgcolor;
+
+    for (int j = j0; j < j1; j++) {
+	const uint8_t* p = spr->data + spr->row[j];
+	int px = x;
+	for (;;) {
+	    uint16_t hdr[2];
+	    memcpy(hdr, p, sizeof(hdr));
+	    p += sizeof(hdr);
+	    if (0 == hdr[1])
+		break;
+	    px += hdr[0];
+	    const int a = MAX(px, 0);
+	    const int b = MIN(px + hdr[1], fb->w);
+	    if (a < b && 1 == fb->bpp) {
+		for (int i = a; i < b; i++) {
+		    fb->fgcolor = p[i - px];
+		    setpixel_1bpp(fb, i, y + j);
+		}
+	    } else if (a < b) {
+		memcpy(&fb->fbp[(a + fb->x) * bpx + (y + j + fb->y) * fb->stride],
+		    p + (a - px) * bpx, (size_t)((b - a) * bpx));
+	    }
+	    p += hdr[1] * bpx;
+	    px += hdr[1];
+	}
+    }
+    fb->fgcolor = fg;
+}
+
+/**
+ * @brief Clip the span x0 … x1 to where t0 + x * dt lies in [lo, hi)
+ */
+static void span_clip(float t0, float dt, float lo, float hi, int* x0, int* x1)
+{
+    if (0.0f == dt) {
+	if (t0 < lo || t0 >= hi)
+	    *x1 = *x0 - 1;
+	return;
+    }
+    float a = (lo - t0) / dt;
+    float b = (hi - t0) / dt;
+    if (a > b) {
+	const float t = a;
+	a = b;
+	b = t;
+    }
+    if (a > (float)*x0)
+	*x0 = a < (float)*x1 ? (int)floorf(a) : *x1 + 1;
+    if (b < (float)*x1)
+	*x1 = b > (float)*x0 ? (int)ceilf(b) : *x0 - 1;
+}
+
+/**
+ * @brief Sample a premultiplied ARGB image bilinearly at @p u, @p v (16.16, pixel centers at .5)
+ *
+ * Taps outside the image are transparent, which gives the edges of a
+ * rotated image a smooth outline.
+ */
+static inline argb_t sample_bilinear(const argb_t* src, int w, int h, int stride, int32_t u, int32_t v)
+{
+    u -= 0x8000;
+    v -= 0x8000;
+    const int x = u >> 16;
+    const int y = v >> 16;
+    const uint32_t fx = (u >> 8) & 0xff;
+    const uint32_t fy = (v >> 8) & 0xff;
+    argb_t p[4] = { 0, 0, 0, 0 };
+
+    if (y >= 0 && y < h) {
+	if (x >= 0 && x < w)
+	    p[0] = src[y * stride + x];
+	if (x + 1 >= 0 && x + 1 < w)
+	    p[1] = src[y * stride + x + 1];
+    }
+    if (y + 1 >= 0 && y + 1 < h) {
+	if (x >= 0 && x < w)
+	    p[2] = src[(y + 1) * stride + x];
+	if (x + 1 >= 0 && x + 1 < w)
+	    p[3] = src[(y + 1) * stride + x + 1];
+    }
+
+    argb_t res = 0;
+    for (int c = 0; c < 32; c += 8) {
+	const uint32_t t = ((p[0] >> c) & 0xff) * (256 - fx) + ((p[1] >> c) & 0xff) * fx;
+	const uint32_t b = ((p[2] >> c) & 0xff) * (256 - fx) + ((p[3] >> c) & 0xff) * fx;
+	res |= ((t * (256 - fy) + b * fy + 0x8000) >> 16) << c;
+    }
+    return res;
+}
+
+/**
+ * @brief Draw a rotated and scaled image
+ *
+ * The pivot @p px, @p py of the source is placed at @p x, @p y and the
+ * image is rotated by @p angle degrees (clockwise on screen) and scaled
+ * by @p scale around it. Only the bounding box of the result is
+ * touched: every destination row of the box is clipped to the part
+ * that maps into the source, and the source coordinates are stepped
+ * along it in 16.16 fixed point. The samples are composited through
+ * the blendspan kernel, so transparent parts of the source are skipped
+ * and opaque parts are stored directly.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x destination x coordinate of the pivot
+ * @param y destination y coordinate of the pivot
+ * @param src pointer to the premultiplied ARGB 8-8-8-8 pixels
+ * @param w width of the image in pixels
+ * @param h height of the image in pixels
+ * @param stride distance between rows of @p src in pixels
+ * @param px pivot x coordinate in the image
+ * @param py pivot y coordinate in the image
+ * @param angle rotation in degrees
+ * @param scale scale factor
+ * @param filter filter_nearest or filter_bilinear
+ */
+void fb_blit_transformed(sfb_t* fb, int x, int y, const argb_t* src, int w, int h, int stride,
+	float px, float py, float angle, float scale, filter_e filter)
+{
+    CHECK_FB(fb);
+    if (!src || w <= 0 || h <= 0 || scale <= 0.0f)
+	return;
+
+    const float rad = angle * (float)M_PI / 180.0f;
+    const float c = cosf(rad);
+    const float s = sinf(rad);
+
+    /* bounding box of the transformed image corners */
+    float bx0 = (float)fb->w, by0 = (float)fb->h, bx1 = -1.0f, by1 = -1.0f;
+    for (int i = 0; i < 4; i++) {
+	const float sx = ((i & 1) ? w : 0) - px;
+	const float sy = ((i & 2) ? h : 0) - py;
+	const float dx = x + scale * (c * sx - s * sy);
+	const float dy = y + scale * (s * sx + c * sy);
+	bx0 = MIN(bx0, dx);
+	by0 = MIN(by0, dy);
+	bx1 = MAX(bx1, dx);
+	by1 = MAX(by1, dy);
+    }
+    const int x0 = MAX(0, (int)floorf(bx0));
+    const int y0 = MAX(0, (int)floorf(by0));
+    const int x1 = MIN(fb->w - 1, (int)ceilf(bx1));
+    const int y1 = MIN(fb->h - 1, (int)ceilf(by1));
+
+    /* inverse mapping: source = pivot + R(-angle) / scale * (dest - x,y) */
+    const float du = c / scale;
+    const float dv = -s / scale;
+    const float eu = s / scale;
+    const float ev = c / scale;
+    const float margin = filter_bilinear == filter ? 0.5f : 0.0f;
+    argb_t row[256];
+
+    for (int yy = y0; yy <= y1; yy++) {
+	const float ry = yy + 0.5f - y;
+	const float u0 = px + du * (x0 + 0.5f - x) + eu * ry;
+	const float v0 = py + dv * (x0 + 0.5f - x) + ev * ry;
+	int a = 0, b = x1 - x0;
+	span_clip(u0, du, -margin, w + margin, &a, &b);
+	span_clip(v0, dv, -margin, h + margin, &a, &b);
+	if (a > b)
+	    continue;
+
+	for (int xs = a; xs <= b; xs += 256) {
+	    const int n = MIN(b + 1 - xs, 256);
+	    int32_t u = (int32_t)((u0 + du * xs) * 65536.0f);
+	    int32_t v = (int32_t)((v0 + dv * xs) * 65536.0f);
+	    const int32_t su = (int32_t)(du * 65536.0f);
+	    const int32_t sv = (int32_t)(dv * 65536.0f);
+	    if (filter_bilinear == filter) {
+		for (int i = 0; i < n; i++, u += su, v += sv)
+		    row[i] = sample_bilinear(src, w, h, stride, u, v);
+	    } else {
+		for (int i = 0; i < n; i++, u += su, v += sv) {
+		    const int sx = u >> 16;
+		    const int sy = v >> 16;
+		    row[i] = (unsigned)sx < (unsigned)w && (unsigned)sy < (unsigned)h ?
+			src[sy * stride + sx] : 0;
+		}
+	    }
+	    fb->blendspan(fb, x0 + xs, yy, row, n);
+	}
+    }
+}
+
+/**
+ * @brief Fill a rectangle with the foreground color at opacity @p alpha
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param alpha opacity (0 … 255)
+ */
+void fb_fill_alpha(sfb_t *fb, int x1, int y1, int x2, int y2, int alpha)
+{
+    CHECK_FB(fb);
+    const uint32_t a = (uint32_t)BOUND(0, alpha, 255);
+    const argb_t c = pix2argb(fb, fb->fgcolor);
+    const argb_t p = (a << 24) |
+	(blend8(0, (c >> 16) & 0xff, a) << 16) |
+	(blend8(0, (c >>  8) & 0xff, a) <<  8) |
+	(blend8(0, (c >>  0) & 0xff, a) <<  0);
+    fb_blend_rect(fb, x1, y1, x2, y2, p);
+}
+
+/**
+ * @brief 4x4 ordered dither matrix (Bayer)
+ */
+static const uint8_t bayer4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+/**
+ * @brief Build a 256 entry color ramp from @p c0 to @p c1
+ *
+ * The channels are stepped in 16.16 fixed point, so every entry
+ * costs three adds.
+ *
+ * @param ramp pointer to 256 ARGB values
+ * @param c0 premultiplied ARGB color at 0
+ * @param c1 premultiplied ARGB color at 255
+ */
+static void ramp_init(argb_t* ramp, argb_t c0, argb_t c1)
+{
+    int32_t v[4], dv[4];
+    for (int c = 0; c < 4; c++) {
+	const int32_t s = (int32_t)((c0 >> (8 * c)) & 0xff);
+	const int32_t e = (int32_t)((c1 >> (8 * c)) & 0xff);
+	v[c] = (s << 16) + 0x8000;
+	dv[c] = (e - s) * 65536 / 255;
+    }
+    for (int i = 0; i < 256; i++) {
+	ramp[i] = 0;
+	for (int c = 0; c < 4; c++) {
+	    ramp[i] |= (argb_t)((v[c] >> 16) & 0xff) << (8 * c);
+	    v[c] += dv[c];
+	}
+    }
+}
+
+/**
+ * @brief Apply the ordered dither for RGB 5-6-5 to a row of @p l pixels
+ *
+ * The threshold is added before the blendspan kernel truncates the
+ * channels to 5 and 6 bits.
+ */
+static void dither_row(argb_t* row, int x, int y, int l)
+{
+    const uint8_t* m = bayer4[y & 3];
+    for (int i = 0; i < l; i++) {
+	const argb_t p = row[i];
+	const uint32_t d = m[(x + i) & 3];
+	const uint32_t r = MIN(255, ((p >> 16) & 0xff) + (d >> 1));
+	const uint32_t g = MIN(255, ((p >>  8) & 0xff) + (d >> 2));
+	const uint32_t b = MIN(255, ((p >>  0) & 0xff) + (d >> 1));
+	row[i] = (p & 0xff000000u) | (r << 16) | (g << 8) | b;
+    }
+}
+
+/**
+ * @brief Fill the region @p rg with colors from @p ramp
+ *
+ * The ramp index of pixel (x, y) is (t0 + x * dtx + y * dty) >> 16,
+ * clamped to 0 … 255. If @p dtx is 0 the rows are constant and are
+ * drawn from a per-row color table, with the copy hline kernel when the
+ * row is opaque and not dithered.
+ */
+static void gradient_fill(sfb_t* fb, const region_t* rg,
+	const argb_t* ramp, int64_t t0, int64_t dtx, int64_t dty)
+{
+    const int dither = fb->dither && 16 == fb->bpp;
+    argb_t row[256];
+    int tl_x, br_x;
+
+    if (0 == dtx) {
+	const color_t fg = fb->fgcolor;
+	int64_t t = t0 + rg->y1 * dty;
+	for (int y = rg->y1; y <= rg->y2; y++, t += dty) {
+	    region_span(rg, y, &tl_x, &br_x);
+	    if (br_x < tl_x)
+		continue;
+	    const argb_t c = ramp[t < 0 ? 0 : t >= (256 << 16) ? 255 : (int)(t >> 16)];
+	    if (0xff000000u == (c & 0xff000000u) && !dither) {
+		fb->fgcolor = fb->rgb2pix((c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+		fb->hline_copy(fb, tl_x, y, br_x + 1 - tl_x);
+		continue;
+	    }
+	    const int n = MIN(br_x + 1 - tl_x, 256);
+	    for (int i = 0; i < n; i++)
+		row[i] = c;
+	    if (dither)
+		dither_row(row, tl_x, y, n);
+	    /* 256 is a multiple of 4, so the dithered row fits every chunk */
+	    for (int x = tl_x; x <= br_x; x += 256)
+		fb->blendspan(fb, x, y, row, MIN(br_x + 1 - x, 256));
+	}
+	fb->fgcolor = fg;
+	return;
+    }
+
+    for (int y = rg->y1; y <= rg->y2; y++) {
+	region_span(rg, y, &tl_x, &br_x);
+	for (int x = tl_x; x <= br_x; x += 256) {
+	    const int n = MIN(br_x + 1 - x, 256);
+	    int64_t t = t0 + x * dtx + y * dty;
+	    for (int i = 0; i < n; i++, t += dtx)
+		row[i] = ramp[t < 0 ? 0 : t >= (256 << 16) ? 255 : (int)(t >> 16)];
+	    if (dither)
+		dither_row(row, x, y, n);
+	    fb->blendspan(fb, x, y, row, n);
+	}
+    }
+}
+
+/**
+ * @brief Fill a rectangle with a linear gradient
+ *
+ * The color changes from @p c0 at @p gx0, @p gy0 to @p c1 at
+ * @p gx1, @p gy1 and is constant beyond both ends. The colors are
+ * premultiplied ARGB, so translucent gradients are composited over
+ * the frame buffer. At 16 bpp the result is dithered if enabled with
+ * @ref fb_set_dither().
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param gx0 gradient start x coordinate
+ * @param gy0 gradient start y coordinate
+ * @param c0 premultiplied ARGB color at the start
+ * @param gx1 gradient end x coordinate
+ * @param gy1 gradient end y coordinate
+ * @param c1 premultiplied ARGB color at the end
+ */
+void fb_fill_linear(sfb_t* fb, int x1, int y1, int x2, int y2,
+	int gx0, int gy0, argb_t c0, int gx1, int gy1, argb_t c1)
+{
+    CHECK_FB(fb);
+    if (fb->xform) {
+	xform_point(fb, &gx0, &gy0);
+	xform_point(fb, &gx1, &gy1);
+    }
+    const int64_t dx = gx1 - gx0;
+    const int64_t dy = gy1 - gy0;
+    const int64_t len2 = dx * dx + dy * dy;
+    region_t rg;
+    argb_t ramp[256];
+
+    if (0 == len2) {
+	fb_blend_rect(fb, x1, y1, x2, y2, c1);
+	return;
+    }
+    if (!region_init(fb, &rg, x1, y1, x2, y2))
+	return;
+    ramp_init(ramp, c0, c1);
+
+    /* index 0 … 255 in 8.16 fixed point; rounding to the nearest entry */
+    const int64_t dtx = dx * (255 << 16) / len2;
+    const int64_t dty = dy * (255 << 16) / len2;
+    const int64_t t0 = -(gx0 * dtx + gy0 * dty) + 0x8000;
+    gradient_fill(fb, &rg, ramp, t0, dtx, dty);
+}
+
+/**
+ * @brief Fill a rectangle with a radial gradient
+ *
+ * The color changes from @p c0 at the center @p cx, @p cy to @p c1 at
+ * radius @p r and is constant beyond. The squared distance is stepped
+ * incrementally along each span and compared against a table of the
+ * squared distances where the ramp index changes. The index moves by
+ * few steps between neighbouring pixels, so no square root is taken.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param cx center x coordinate
+ * @param cy center y coordinate
+ * @param r radius in pixels
+ * @param c0 premultiplied ARGB color at the center
+ * @param c1 premultiplied ARGB color at radius @p r
+ */
+void fb_fill_radial(sfb_t* fb, int x1, int y1, int x2, int y2,
+	int cx, int cy, int r, argb_t c0, argb_t c1)
+{
+    CHECK_FB(fb);
+    const int dither = fb->dither && 16 == fb->bpp;
+    int64_t edge[256];
+    argb_t ramp[256];
+    argb_t row[256];
+    region_t rg;
+    int t = 0;
+
+    if (fb->xform) {
+	xform_point(fb, &cx, &cy);
+	r = xform_len(fb->xr, r);
+    }
+    if (r <= 0) {
+	fb_blend_rect(fb, x1, y1, x2, y2, c1);
+	return;
+    }
+    if (!region_init(fb, &rg, x1, y1, x2, y2))
+	return;
+    ramp_init(ramp, c0, c1);
+    /* index t covers distances below (t + 0.5) * r / 255 */
+    for (int i = 0; i < 256; i++) {
+	const double e = (double)(2 * i + 1) * r / 510.0;
+	edge[i] = (int64_t)ceil(e * e);
+    }
+
+    for (int y = rg.y1; y <= rg.y2; y++) {
+	const int64_t vy = y - cy;
+	int tl_x, br_x;
+	region_span(&rg, y, &tl_x, &br_x);
+	for (int x = tl_x; x <= br_x; x += 256) {
+	    const int n = MIN(br_x + 1 - x, 256);
+	    int64_t vx = x - cx;
+	    int64_t d2 = vx * vx + vy * vy;
+	    for (int i = 0; i < n; i++) {
+		while (t < 255 && d2 >= edge[t])
+		    t++;
+		while (t > 0 && d2 < edge[t - 1])
+		    t--;
+		row[i] = ramp[t];
+		/* (vx + 1)² = vx² + 2 vx + 1 */
+		d2 += 2 * vx + 1;
+		vx++;
+	    }
+	    if (dither)
+		dither_row(row, x, y, n);
+	    fb->blendspan(fb, x, y, row, n);
+	}
+    }
+}
+
+/**
+ * @brief Maximum number of threads for @ref fb_blur()
+ */
+#define	BLUR_THREADS	4
+
+/**
+ * @brief Minimum number of pixels in a region to blur it with threads
+ */
+#define	BLUR_MIN_AREA	(128 * 128)
+
+/**
+ * @brief Region and work share of a thread blurring it
+ *
+ * The region is unpacked to R, G, B bytes in @p buf. Each thread runs
+ * the horizontal passes on the rows and the vertical passes on the
+ * columns @p first up to but not including @p last.
+ */
+typedef struct {
+    sfb_t* fb;
+    int x, y, w, h;		/*!< region in frame buffer coordinates */
+    const int* r;		/*!< box radius of each pass */
+    int nbox;			/*!< number of passes */
+    uint8_t* buf;		/*!< unpacked region */
+    int first, last;		/*!< rows or columns of this thread */
+}   blur_t;
+
+/**
+ * @brief Box filter @p n samples @p ss bytes apart from @p src to @p dst, @p ds bytes apart
+ *
+ * A running sum over the window makes the cost independent of the
+ * radius @p r. Samples beyond the ends repeat the end samples.
+ */
+static void box_line(const uint8_t* src, size_t ss, uint8_t* dst, size_t ds, int n, int r)
+{
+    const uint64_t inv = (1u << 24) / (uint32_t)(2 * r + 1);
+    const int k = MIN(r, n - 1);
+    uint32_t sum = (uint32_t)(r + 1) * src[0] + (uint32_t)(r - k) * src[(n - 1) * ss];
+
+    for (int i = 1; i <= k; i++)
+	sum += src[i * ss];
+    for (int i = 0; i < n; i++) {
+	dst[i * ds] = (uint8_t)((sum * inv + (1u << 23)) >> 24);
+	sum += src[MIN(i + r + 1, n - 1) * ss];
+	sum -= src[MAX(i - r, 0) * ss];
+    }
+}
+
+/**
+ * @brief Unpack the rows of the region and run the horizontal passes
+ */
+static void* blur_rows(void* arg)
+{
+    blur_t* b = (blur_t *)arg;
+    sfb_t* fb = b->fb;
+    const size_t len = (size_t)b->w * 3;
+    uint8_t* tmp = (uint8_t *)malloc(len);
+    if (!tmp)
+	return arg;
+
+    for (int j = b->first; j < b->last; j++) {
+	uint8_t* row = b->buf + j * len;
+	const uint8_t* p = fb->fbp + (b->x + fb->x) * (fb->bpp / 8) +
+	    (b->y + j + fb->y) * fb->stride;
+	if (16 == fb->bpp) {
+	    for (int i = 0; i < b->w; i++, p += 2) {
+		const uint32_t pix = p[0] | (p[1] << 8);
+		const uint32_t r = (pix >> 11) & 0x1f;
+		const uint32_t g = (pix >> 5) & 0x3f;
+		const uint32_t bl = pix & 0x1f;
+		row[3*i+0] = (uint8_t)((r << 3) | (r >> 2));
+		row[3*i+1] = (uint8_t)((g << 2) | (g >> 4));
+		row[3*i+2] = (uint8_t)((bl << 3) | (bl >> 2));
+	    }
+	} else {
+	    for (int i = 0; i < b->w; i++, p += 4) {
+		row[3*i+0] = p[2];
+		row[3*i+1] = p[1];
+		row[3*i+2] = p[0];
+	    }
+	}
+	for (int k = 0; k < b->nbox; k++) {
+	    memcpy(tmp, row, len);
+	    for (int c = 0; c < 3; c++)
+		box_line(tmp + c, 3, row + c, 3, b->w, b->r[k]);
+	}
+    }
+    free(tmp);
+    return NULL;
+}
+
+/**
+ * @brief Run the vertical passes on the columns and pack them into the frame buffer
+ */
+static void* blur_cols(void* arg)
+{
+    blur_t* b = (blur_t *)arg;
+    sfb_t* fb = b->fb;
+    const size_t step = (size_t)b->w * 3;
+    uint8_t* tmp = (uint8_t *)malloc(b->h);
+    if (!tmp)
+	return arg;
+
+    for (int i = b->first; i < b->last; i++) {
+	for (int c = 0; c < 3; c++) {
+	    uint8_t* col = b->buf + 3 * i + c;
+	    for (int k = 0; k < b->nbox; k++) {
+		for (int j = 0; j < b->h; j++)
+		    tmp[j] = col[j * step];
+		box_line(tmp, 1, col, step, b->h, b->r[k]);
+	    }
+	}
+    }
+
+    for (int j = 0; j < b->h; j++) {
+	const uint8_t* row = b->buf + j * step;
+	uint8_t* p = fb->fbp + (b->x + b->first + fb->x) * (fb->bpp / 8) +
+	    (b->y + j + fb->y) * fb->stride;
+	if (16 == fb->bpp) {
+	    for (int i = b->first; i < b->last; i++, p += 2) {
+		const uint32_t pix = rgb2pix_16bpp(row[3*i+0], row[3*i+1], row[3*i+2]);
+		p[0] = (uint8_t)pix;
+		p[1] = (uint8_t)(pix >> 8);
+	    }
+	} else {
+	    for (int i = b->first; i < b->last; i++, p += 4) {
+		p[0] = row[3*i+2];
+		p[1] = row[3*i+1];
+		p[2] = row[3*i+0];
+	    }
+	}
+    }
+    free(tmp);
+    return NULL;
+}
+
+/**
+ * @brief Split 0 … @p n - 1 between @p nt threads running @p fn
+ * @return 0 on success, -1 if a thread ran out of memory
+ */
+static int blur_run(blur_t* job, int nt, int n, void* (*fn)(void*))
+{
+    int res = 0;
+#if defined(SFB_THREADS)
+    pthread_t tid[BLUR_THREADS];
+    int started[BLUR_THREADS];
+#endif
+
+    for (int t = 0; t < nt; t++) {
+	job[t].first = n * t / nt;
+	job[t].last = n * (t + 1) / nt;
+    }
+#if defined(SFB_THREADS)
+    for (int t = 1; t < nt; t++)
+	started[t] = 0 == pthread_create(&tid[t], NULL, fn, &job[t]);
+#endif
+    if (fn(&job[0]))
+	res = -1;
+    for (int t = 1; t < nt; t++) {
+	void* ret = NULL;
+#if defined(SFB_THREADS)
+	if (started[t])
+	    pthread_join(tid[t], &ret);
+	else
+#endif
+	    ret = fn(&job[t]);
+	if (ret)
+	    res = -1;
+    }
+    return res;
+}
+
+/**
+ * @brief Blur the clipped region with @p nbox box passes of radii @p r
+ */
+static int blur_region(sfb_t* fb, int x1, int y1, int x2, int y2, const int* r, int nbox)
+{
+    const int tl_x = MAX(0, MIN(x1, x2));
+    const int tl_y = MAX(0, MIN(y1, y2));
+    const int br_x = MIN(fb->w - 1, MAX(x1, x2));
+    const int br_y = MIN(fb->h - 1, MAX(y1, y2));
+
+    if (!fb->shadow) {
+	error(fb, "Error: blurring needs a shadow buffer, see fb_set_shadow()");
+	return -1;
+    }
+    if (16 != fb->bpp && 32 != fb->bpp) {
+	error(fb, "Error: blurring is not supported at %d bpp", fb->bpp);
+	return -1;
+    }
+    if (br_x < tl_x || br_y < tl_y)
+	return 0;
+
+    blur_t job[BLUR_THREADS];
+    const int w = br_x + 1 - tl_x;
+    const int h = br_y + 1 - tl_y;
+    uint8_t* buf = (uint8_t *)malloc((size_t)w * h * 3);
+    if (!buf) {
+	error(fb, "Error: insufficient memory to blur %dx%d pixels", w, h);
+	return -1;
+    }
+
+    int nt = 1;
+#if defined(SFB_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    if (w * h >= BLUR_MIN_AREA)
+	nt = (int)BOUND(sysconf(_SC_NPROCESSORS_ONLN), 1, BLUR_THREADS);
+#endif
+    for (int t = 0; t < nt; t++) {
+	job[t].fb = fb;
+	job[t].x = tl_x;
+	job[t].y = tl_y;
+	job[t].w = w;
+	job[t].h = h;
+	job[t].r = r;
+	job[t].nbox = nbox;
+	job[t].buf = buf;
+    }
+
+    int res = blur_run(job, nt, h, blur_rows);
+    if (0 == res)
+	res = blur_run(job, MIN(nt, w), w, blur_cols);
+    if (res < 0)
+	error(fb, "Error: insufficient memory to blur %dx%d pixels", w, h);
+    free(buf);
+    return res;
+}
+
+/**
+ * @brief Blur a rectangle with a box filter of radius @p r
+ *
+ * Every pixel becomes the average of the (2 @p r + 1)² pixels around
+ * it, computed as a horizontal and a vertical pass with running sums,
+ * so the cost does not depend on the radius. The blur works in place
+ * on the shadow buffer and never reads device memory; large regions
+ * are split between threads. Only 16 and 32 bpp are supported.
+ * Call @ref fb_flush_rect() to show the result.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param r radius in pixels
+ * @return 0 on success, -1 on error (no shadow buffer, depth or memory)
+ */
+int fb_blur_box(sfb_t* fb, int x1, int y1, int x2, int y2, int r)
+{
+    CHECK_FB_RET(fb, -1);
+    if (r <= 0)
+	return 0;
+    r = MIN(r, 8192);
+    return blur_region(fb, x1, y1, x2, y2, &r, 1);
+}
+
+/**
+ * @brief Blur a rectangle with an approximated Gaussian filter
+ *
+ * Three box passes in each direction with widths chosen for the
+ * standard deviation @p sigma are close to a Gaussian blur. See
+ * @ref fb_blur_box() for the constraints.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ * @param sigma standard deviation in pixels
+ * @return 0 on success, -1 on error (no shadow buffer, depth or memory)
+ */
+int fb_blur(sfb_t* fb, int x1, int y1, int x2, int y2, float sigma)
+{
+    CHECK_FB_RET(fb, -1);
+    if (sigma <= 0.0f)
+	return 0;
+    sigma = MIN(sigma, 4096.0f);
+
+    /* odd box widths wl and wl + 2, m passes of the smaller one */
+    const int n = 3;
+    int wl = (int)floorf(sqrtf(12.0f * sigma * sigma / n + 1.0f));
+    if (0 == (wl & 1))
+	wl--;
+    const float mf = (12.0f * sigma * sigma - n * wl * wl - 4.0f * n * wl - 3.0f * n) /
+	(-4.0f * wl - 4.0f);
+    const int m = (int)lrintf(mf);
+    int r[3];
+    for (int i = 0; i < n; i++)
+	r[i] = ((i < m ? wl : wl + 2) - 1) / 2;
+    if (0 == r[0] && 0 == r[1] && 0 == r[2])
+	return 0;
+    return blur_region(fb, x1, y1, x2, y2, r, n);
+}
+
+/**
+ * @brief Maximum number of pending spans for @ref fb_flood_fill()
+ */
+#define	FLOOD_STACK	1024
+
+/**
+ * @brief Pending span of a flood fill
+ *
+ * The span xl … xr on row y was filled; row y + dy still has to be
+ * scanned below (or above) it.
+ */
+typedef struct {
+    int y;
+    int xl;
+    int xr;
+    int dy;
+}   flood_t;
+
+/**
+ * @brief Flood fill the region connected to @p x, @p y
+ *
+ * All 4-connected pixels with the color of the seed pixel are set to
+ * the foreground color. This is the span stack scanline algorithm
+ * (Heckbert, Graphics Gems): whole runs are drawn with the copy hline
+ * kernel and every pixel is read at most three times. The raster
+ * operation is ignored, since a filled pixel must no longer match the
+ * seed color. The stack has a fixed size; if it overflows the fill is
+ * left incomplete and -1 is returned.
+ *
+ * Pixels are read through the frame buffer pointer, so with a shadow
+ * buffer (see @ref fb_set_shadow()) device memory is never read.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x seed x coordinate
+ * @param y seed y coordinate
+ * @return 0 on success, -1 on stack overflow
+ */
+int fb_flood_fill(sfb_t* fb, int x, int y)
+{
+    CHECK_FB_RET(fb, -1);
+    flood_t stack[FLOOD_STACK];
+    int sp = 0;
+    int overflow = 0;
+
+    if (x < 0 || x >= fb->w || y < 0 || y >= fb->h)
+	return 0;
+    const color_t ov = fb->getpixel(fb, x, y);
+    if (ov == fb->fgcolor)
+	return 0;
+
+#define	FLOOD_PUSH(_y,_xl,_xr,_dy) do {				\
+    if ((_y) + (_dy) >= 0 && (_y) + (_dy) < fb->h) {		\
+	if (sp < FLOOD_STACK) {					\
+	    stack[sp].y = (_y);					\
+	    stack[sp].xl = (_xl);				\
+	    stack[sp].xr = (_xr);				\
+	    stack[sp].dy = (_dy);				\
+	    sp++;						\
+	} else {						\
+	    overflow = 1;					\
+	}							\
+    }								\
+} while (0)
+
+    FLOOD_PUSH(y, x, x, 1);
+    FLOOD_PUSH(y + 1, x, x, -1);
+
+    while (sp > 0) {
+	sp--;
+	const int dy = stack[sp].dy;
+	const int x1 = stack[sp].xl;
+	const int x2 = stack[sp].xr;
+	int l;
+	y = stack[sp].y + dy;
+
+	/* extend to the left of x1 */
+	for (x = x1; x >= 0 && fb->getpixel(fb, x, y) == ov; x--)
+	    ;
+	int run = x < x1;
+	if (run) {
+	    fb->hline_copy(fb, x + 1, y, x1 - x);
+	    l = x + 1;
+	    if (l < x1)
+		FLOOD_PUSH(y, l, x1 - 1, -dy);
+	    x = x1 + 1;
+	} else {
+	    /* x1 is not inside: look for the next run below the parent span */
+	    for (x++; x <= x2 && fb->getpixel(fb, x, y) != ov; x++)
+		;
+	    l = x;
+	}
+	/* the run started left of x1 continues to the right even if x1 == x2 */
+	while (run || x <= x2) {
+	    const int start = x;
+	    run = 0;
+	    for (; x < fb->w && fb->getpixel(fb, x, y) == ov; x++)
+		;
+	    if (x > start)
+		fb->hline_copy(fb, start, y, x - start);
+	    FLOOD_PUSH(y, l, x - 1, dy);
+	    if (x > x2 + 1)
+		FLOOD_PUSH(y, x2 + 1, x - 1, -dy);
+	    for (x++; x <= x2 && fb->getpixel(fb, x, y) != ov; x++)
+		;
+	    l = x;
+	}
+    }
+#undef	FLOOD_PUSH
+
+    if (overflow) {
+	error(fb, "Error: flood fill span stack overflow at %d entries", FLOOD_STACK);
+	return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Draw a circle's octants @p oct at @p x, @p y with radius @p r
+ *
+ * @param fb pointer to the frame buffer context
+ * @param oct octants to draw (0 … 7 for counter-clockwise octants)
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_circle_octants(sfb_t *fb, uint8_t oct, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r = xform_len(fb->xr, r);
+    }
+    int dda = r;
+    int dx = r;
+    int dy = 0;
+    while (dx >= dy) {
+	/* octants meet on the axes and diagonals: plot shared pixels once */
+	unsigned o = oct;
+	if (0 == dx)
+	    o = o ? 0x01 : 0;
+	else if (0 == dy)
+	    o = (o | (o & 0x54) >> 1 | o >> 7) & 0x2b;
+	else if (dx == dy)
+	    o = (o | (o & 0xaa) >> 1) & 0x55;
+	if (o & (1 << 0))
+	    fb->setpixel(fb, x + dx, y - dy);
+	if (o & (1 << 1))
+	    fb->setpixel(fb, x + dy, y - dx);
+	if (o & (1 << 2))
+	    fb->setpixel(fb, x - dy, y - dx);
+	if (o & (1 << 3))
+	    fb->setpixel(fb, x - dx, y - dy);
+	if (o & (1 << 4))
+	    fb->setpixel(fb, x - dx, y + dy);
+	if (o & (1 << 5))
+	    fb->setpixel(fb, x - dy, y + dx);
+	if (o & (1 << 6))
+	    fb->setpixel(fb, x + dy, y + dx);
+	if (o & (1 << 7))
+	    fb->setpixel(fb, x + dx, y + dy);
+
+	dy++;
+	dda -= dy;
+	if (dda < 0) {
+	    dda += dx;
+	    dx--;
+	}
+    }
+}
+
+/**
+ * @brief Draw a circle at @p x, @p y with radius @p r
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_circle(sfb_t *fb, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    fb_circle_octants(fb, 0xff, x, y, r);
+}
+
+/**
+ * @brief Draw a disc's octants @p oct at @p x, @p y with radius @p r
+ *
+ * @param fb pointer to the frame buffer context
+ * @param oct octants to draw (0 … 7 for counter-clockwise octants)
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_disc_octants(sfb_t *fb, uint8_t oct, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r = xform_len(fb->xr, r);
+    }
+    int dda = r;
+    int dx = r;
+    int dy = 0;
+    while (dx >= dy) {
+	const int l = dx - dy;
+	if (0 == dy) {
+	    /* the octants share the axes: draw those pixels once */
+	    if (oct & (dx ? 0xe9 : 0x08))
+		fb->fillspan(fb, x, y, 1);
+	    if (dx > 0) {
+		if (oct & 0x81)
+		    fb->fillspan(fb, x + 1, y, l - 1);
+		if (oct & 0x18)
+		    fb->fillspan(fb, x - dx, y, l);
+		if (oct & 0x06)
+		    fill_vline(fb, x, y - dx, l);
+		if (oct & 0x60)
+		    fill_vline(fb, x, y + 1, l - 1);
+	    }
+	} else {
+	    if (oct & (1 << 0))
+		fb->fillspan(fb, x + dy, y - dy, l);
+	    if (oct & (1 << 1))
+		fill_vline(fb, x + dy, y - dx, l);
+	    if (oct & (1 << 2))
+		fill_vline(fb, x - dy, y - dx, l);
+	    if (oct & (1 << 3))
+		fb->fillspan(fb, x - dx, y - dy, l + 1); // FIXME: + 1 or there is a gap?
+	    if (oct & (1 << 4))
+		fb->fillspan(fb, x - dx, y + dy, l);
+	    if (oct & (1 << 5))
+		fill_vline(fb, x - dy, y + dy, l);
+	    if (oct & (1 << 6)) {
+		/* the corner pixel is octant 7's when both are drawn */
+		const int k = (oct & (1 << 7)) ? 1 : 0;
+		fill_vline(fb, x + dy, y + dy + k, l - k);
+	    }
+	    if (oct & (1 << 7))
+		fb->fillspan(fb, x + dy, y + dy, l);
+	}
+	dy++;
+	dda -= dy;
+	if (dda < 0) {
+	    dda += dx;
+	    dx--;
+	}
+    }
+}
+
+/**
+ * @brief Draw a dist at @p x, @p y with radius @p r
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_disc(sfb_t *fb, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    fb_disc_octants(fb, 0xff, x, y, r);
+}
+
+/**
+ * @brief Sine table for 0 … 90 degrees in 2.14 fixed point
+ */
+static const int16_t sin_tab[91] = {
+        0,   286,   572,   857,  1143,  1428,  1713,  1997,
+     2280,  2563,  2845,  3126,  3406,  3686,  3964,  4240,
+     4516,  4790,  5063,  5334,  5604,  5872,  6138,  6402,
+     6664,  6924,  7182,  7438,  7692,  7943,  8192,  8438,
+     8682,  8923,  9162,  9397,  9630,  9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982,
+    12176, 12365, 12551, 12733, 12911, 13085, 13255, 13421,
+    13583, 13741, 13894, 14044, 14189, 14330, 14466, 14598,
+    14726, 14849, 14968, 15082, 15191, 15296, 15396, 15491,
+    15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362,
+    16374, 16382, 16384
+};
+
+/**
+ * @brief Return the sine of @p deg degrees in 2.14 fixed point
+ * @param deg angle in degrees (any value)
+ * @return sine value (-16384 … 16384)
+ */
+static int isin(int deg)
+{
+    deg %= 360;
+    if (deg < 0)
+	deg += 360;
+    if (deg <= 90)
+	return sin_tab[deg];
+    if (deg <= 180)
+	return sin_tab[180 - deg];
+    if (deg <= 270)
+	return -sin_tab[deg - 180];
+    return -sin_tab[360 - deg];
+}
+
+/**
+ * @brief Return the cosine of @p deg degrees in 2.14 fixed point
+ * @param deg angle in degrees (any value)
+ * @return cosine value (-16384 … 16384)
+ */
+static int icos(int deg)
+{
+    return isin(deg + 90);
+}
+
+/**
+ * @brief Emit a horizontal span from @p x1 to @p x2 (inclusive) on row @p y
+ *
+ * This is the common span emitter of the scanline fillers.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first x coordinate
+ * @param x2 last x coordinate
+ * @param y row
+ */
+static void hspan(sfb_t* fb, int x1, int x2, int y)
+{
+    if (x1 > x2) {
+	const int t = x1;
+	x1 = x2;
+	x2 = t;
+    }
+    fb->fillspan(fb, x1, y, x2 + 1 - x1);
+}
+
+/**
+ * @brief Emit a horizontal span like @ref hspan(), ignoring the raster operation
+ */
+static void hspan_copy(sfb_t* fb, int x1, int x2, int y)
+{
+    if (x1 > x2) {
+	const int t = x1;
+	x1 = x2;
+	x2 = t;
+    }
+    if (fb->fillspan == fb->hline)
+	fb->hline_copy(fb, x1, y, x2 + 1 - x1);
+    else
+	fb->fillspan(fb, x1, y, x2 + 1 - x1);
+}
+
+/**
+ * @brief Callback for each point (@p dx, @p dy) of the first quadrant of an ellipse
+ *
+ * The points are generated in order from (0, ry) to (rx, 0).
+ */
+typedef void (*ellipse_cb)(sfb_t* fb, void* arg, int dx, int dy);
+
+/**
+ * @brief Walk the first quadrant of an ellipse with radii @p rx and @p ry
+ *
+ * Integer midpoint algorithm: region 1 steps x while the slope is
+ * shallower than -1, region 2 steps y for the rest of the quadrant.
+ * Both radii must be positive; callers handle degenerate ellipses.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param rx horizontal radius
+ * @param ry vertical radius
+ * @param cb callback for each point
+ * @param arg argument passed to the callback
+ */
+static void ellipse_quadrant(sfb_t* fb, int rx, int ry, ellipse_cb cb, void* arg)
+{
+    const int64_t a2 = (int64_t)rx * rx;
+    const int64_t b2 = (int64_t)ry * ry;
+    int x = 0;
+    int y = ry;
+    int64_t px = 0;
+    int64_t py = 2 * a2 * y;
+    int64_t p = b2 - a2 * ry + a2 / 4;
+
+    /* Region 1 */
+    while (px < py) {
+	cb(fb, arg, x, y);
+	x++;
+	px += 2 * b2;
+	if (p < 0) {
+	    p += b2 + px;
+	} else {
+	    y--;
+	    py -= 2 * a2;
+	    p += b2 + px - py;
+	}
+    }
+
+    /* Region 2 */
+    p = b2 * ((int64_t)x * x + x) + b2 / 4 +
+	a2 * (int64_t)(y - 1) * (y - 1) - a2 * b2;
+    while (y >= 0) {
+	cb(fb, arg, x, y);
+	y--;
+	py -= 2 * a2;
+	if (p > 0) {
+	    p += a2 - py;
+	} else {
+	    x++;
+	    px += 2 * b2;
+	    p += a2 - py + px;
+	}
+    }
+}
+
+/**
+ * @brief State of the ellipse outline, fill and arc callbacks
+ */
+typedef struct {
+    int x, y;			/*!< center coordinates */
+    int rx, ry;			/*!< radii */
+    int row_x, row_y;		/*!< pending span for the fill */
+    int64_t sx, sy;		/*!< arc start direction */
+    int64_t ex, ey;		/*!< arc end direction */
+    int wide;			/*!< arc sweep is more than 180 degrees */
+}   ellipse_t;
+
+static void ellipse_plot(sfb_t* fb, void* arg, int dx, int dy)
+{
+    const ellipse_t* e = (const ellipse_t *)arg;
+    fb->setpixel(fb, e->x + dx, e->y + dy);
+    if (dx)
+	fb->setpixel(fb, e->x - dx, e->y + dy);
+    if (dy) {
+	fb->setpixel(fb, e->x + dx, e->y - dy);
+	if (dx)
+	    fb->setpixel(fb, e->x - dx, e->y - dy);
+    }
+}
+
+static void ellipse_flush(sfb_t* fb, ellipse_t* e)
+{
+    hspan(fb, e->x - e->row_x, e->x + e->row_x, e->y - e->row_y);
+    if (e->row_y)
+	hspan(fb, e->x - e->row_x, e->x + e->row_x, e->y + e->row_y);
+}
+
+static void ellipse_span(sfb_t* fb, void* arg, int dx, int dy)
+{
+    ellipse_t* e = (ellipse_t *)arg;
+    if (dy != e->row_y) {
+	ellipse_flush(fb, e);
+	e->row_y = dy;
+    }
+    e->row_x = dx;
+}
+
+/**
+ * @brief Return non zero if the direction (@p vx, @p vy) is inside the arc @p e
+ */
+static int arc_inside(const ellipse_t* e, int64_t vx, int64_t vy)
+{
+    const int64_t cs = e->sx * vy - e->sy * vx;	/* start x v */
+    const int64_t ce = vx * e->ey - vy * e->ex;	/* v x end */
+    if (e->wide)
+	return cs >= 0 || ce >= 0;
+    return cs >= 0 && ce >= 0;
+}
+
+static uint32_t isqrt64(uint64_t v);
+
+/**
+ * @brief Plot the arc @p e of an ellipse with a zero radius
+ *
+ * The ellipse is a line. A pixel on it belongs to the arc if one of
+ * the two points of the circle with the other radius that project
+ * onto it does.
+ */
+static void arc_line(sfb_t* fb, const ellipse_t* e)
+{
+    const int r = MAX(e->rx, e->ry);
+    for (int i = -r; i <= r; i++) {
+	const int64_t d = isqrt64((uint64_t)((int64_t)r * r - (int64_t)i * i));
+	if (e->rx) {
+	    if (arc_inside(e, i, d) || arc_inside(e, i, -d))
+		fb->setpixel(fb, e->x + i, e->y);
+	} else {
+	    if (arc_inside(e, d, i) || arc_inside(e, -d, i))
+		fb->setpixel(fb, e->x, e->y + i);
+	}
+    }
+}
+
+static void arc_plot(sfb_t* fb, void* arg, int dx, int dy)
+{
+    const ellipse_t* e = (const ellipse_t *)arg;
+    /* scale to the parametric angle's direction (dx / rx, dy / ry) */
+    const int64_t vx = (int64_t)dx * e->ry;
+    const int64_t vy = (int64_t)dy * e->rx;
+
+    if (arc_inside(e, vx, vy))
+	fb->setpixel(fb, e->x + dx, e->y + dy);
+    if (dx && arc_inside(e, -vx, vy))
+	fb->setpixel(fb, e->x - dx, e->y + dy);
+    if (dy) {
+	if (arc_inside(e, vx, -vy))
+	    fb->setpixel(fb, e->x + dx, e->y - dy);
+	if (dx && arc_inside(e, -vx, -vy))
+	    fb->setpixel(fb, e->x - dx, e->y - dy);
+    }
+}
+
+/**
+ * @brief Draw an ellipse at @p x, @p y with radii @p rx and @p ry
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param rx horizontal radius in pixels
+ * @param ry vertical radius in pixels
+ */
+void fb_ellipse(sfb_t *fb, int x, int y, int rx, int ry)
+{
+    CHECK_FB(fb);
+    if (rx < 0 || ry < 0)
+	return;
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	rx = xform_len(fb->xrx, rx);
+	ry = xform_len(fb->xry, ry);
+    }
+    if (0 == ry) {
+	fb->hline(fb, x - rx, y, 2 * rx + 1);
+	return;
+    }
+    if (0 == rx) {
+	fb->vline(fb, x, y - ry, 2 * ry + 1);
+	return;
+    }
+    ellipse_t e = { .x = x, .y = y, .rx = rx, .ry = ry };
+    ellipse_quadrant(fb, rx, ry, ellipse_plot, &e);
+}
+
+/**
+ * @brief Fill an ellipse at @p x, @p y with radii @p rx and @p ry
+ *
+ * Every row of the ellipse is emitted as exactly one span.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param rx horizontal radius in pixels
+ * @param ry vertical radius in pixels
+ */
+void fb_ellipse_fill(sfb_t *fb, int x, int y, int rx, int ry)
+{
+    CHECK_FB(fb);
+    if (rx < 0 || ry < 0)
+	return;
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	rx = xform_len(fb->xrx, rx);
+	ry = xform_len(fb->xry, ry);
+    }
+    if (0 == ry) {
+	hspan(fb, x - rx, x + rx, y);
+	return;
+    }
+    if (0 == rx) {
+	fill_vline(fb, x, y - ry, 2 * ry + 1);
+	return;
+    }
+    ellipse_t e = { .x = x, .y = y, .rx = rx, .ry = ry, .row_y = ry };
+    ellipse_quadrant(fb, rx, ry, ellipse_span, &e);
+    ellipse_flush(fb, &e);
+}
+
+/**
+ * @brief Draw an elliptical arc at @p x, @p y with radii @p rx and @p ry
+ *
+ * Angles are in degrees, 0 is at 3 o'clock and they increase clockwise,
+ * just like gdImageArc() does. The angles are parametric, i.e. the
+ * point at angle t is (x + rx * cos(t), y + ry * sin(t)).
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param rx horizontal radius in pixels
+ * @param ry vertical radius in pixels
+ * @param start start angle in degrees
+ * @param end end angle in degrees
+ */
+void fb_arc(sfb_t *fb, int x, int y, int rx, int ry, int start, int end)
+{
+    CHECK_FB(fb);
+    if (rx < 0 || ry < 0)
+	return;
+
+    int sweep = (end - start) % 360;
+    if (sweep < 0)
+	sweep += 360;
+    if (0 == sweep) {
+	if (end != start)
+	    fb_ellipse(fb, x, y, rx, ry);
+	return;
+    }
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	rx = xform_len(fb->xrx, rx);
+	ry = xform_len(fb->xry, ry);
+    }
+
+    ellipse_t e = {
+	.x = x, .y = y, .rx = rx, .ry = ry,
+	.sx = icos(start), .sy = isin(start),
+	.ex = icos(end), .ey = isin(end),
+	.wide = sweep > 180
+    };
+    if (0 == rx || 0 == ry) {
+	arc_line(fb, &e);
+	return;
+    }
+    ellipse_quadrant(fb, rx, ry, arc_plot, &e);
+}
+
+/**
+ * @brief Integer square root of @p v
+ */
+static uint32_t isqrt64(uint64_t v)
+{
+    uint64_t res = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > v)
+	bit >>= 2;
+    while (bit) {
+	if (v >= res + bit) {
+	    v -= res + bit;
+	    res = (res >> 1) + bit;
+	} else {
+	    res >>= 1;
+	}
+	bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+/**
+ * @brief Edge coverage of one octant of an anti-aliased circle
+ *
+ * For every column x of the octant above the diagonal (x <= y) the
+ * pixel row jb[x] is covered partially by a[x] / 255, the rows below
+ * it are covered fully. All other octants are mirrored from this one.
+ */
+typedef struct {
+    int n;			/*!< number of columns */
+    int* jb;			/*!< partially covered row per column */
+    uint8_t* a;			/*!< coverage of that row (0 … 255) */
+}   octant_t;
+
+/**
+ * @brief Compute the octant for a circle with radius @p r256 (24.8 fixed point)
+ *
+ * The radius is measured from the center of the center pixel.
+ * @param o pointer to the octant with room for (r256 >> 8) + 2 columns
+ * @param r256 radius in 1/256 pixels; negative for an empty circle
+ */
+static void octant_init(octant_t* o, int r256)
+{
+    o->n = 0;
+    if (r256 < 0)
+	return;
+    const uint64_t rr = (uint64_t)r256 * r256;
+    for (int x = 0; ; x++) {
+	const uint64_t xx = (uint64_t)x * x << 16;
+	if (xx > rr)
+	    break;
+	const int t = (int)isqrt64(rr - xx) + 128;
+	if (x > (t >> 8))
+	    break;
+	o->jb[x] = t >> 8;
+	o->a[x] = (uint8_t)(t & 0xff);
+	o->n = x + 1;
+    }
+}
+
+/**
+ * @brief Return the coverage of pixel offset @p x, @p y (both >= 0)
+ */
+static uint32_t octant_cov(const octant_t* o, int x, int y)
+{
+    if (x > y) {
+	const int t = x;
+	x = y;
+	y = t;
+    }
+    if (x >= o->n || y > o->jb[x])
+	return 0;
+    return y < o->jb[x] ? 255 : o->a[x];
+}
+
+/**
+ * @brief Find the fully covered (@p k) and the touched (@p e) columns of row @p y
+ *
+ * Pixels 0 <= x < k are fully covered, k <= x < e partially, the
+ * rest not at all.
+ */
+static void octant_row(const octant_t* o, int y, int* k, int* e)
+{
+    if (y < o->n && o->jb[y] > y) {
+	/* steep part: one edge pixel mirrored from column y */
+	*k = o->jb[y];
+	*e = o->jb[y] + 1;
+	return;
+    }
+    int i = 0;
+    while (i < o->n && o->jb[i] > y)
+	i++;
+    *k = i;
+    while (i < o->n && o->jb[i] >= y)
+	i++;
+    *e = i;
+}
+
+/**
+ * @brief Emit an anti-aliased ring between the octants @p oo (outer) and @p oi (inner)
+ *
+ * Fully covered runs go to the copy span kernel, edge pixels to the
+ * blendpixel kernel with the difference of outer and inner coverage.
+ * If @p arc is not NULL only pixels inside the arc are drawn.
+ */
+static void ring_emit(sfb_t* fb, int cx, int cy, const octant_t* oo, const octant_t* oi, const ellipse_t* arc)
+{
+    if (0 == oo->n)
+	return;
+    for (int y = 0; y <= oo->jb[0]; y++) {
+	int ko, eo, ki, ei;
+	octant_row(oo, y, &ko, &eo);
+	octant_row(oi, y, &ki, &ei);
+
+	for (int x = ki; x < eo; x++) {
+	    const int solid = x >= ei && x < ko;
+	    const uint32_t a = solid ? 255 :
+		octant_cov(oo, x, y) - octant_cov(oi, x, y);
+	    if (0 == a)
+		continue;
+	    if (solid && !arc) {
+		/* the whole run at once, mirrored */
+		if (0 == ei) {
+		    hspan_copy(fb, cx - ko + 1, cx + ko - 1, cy + y);
+		    if (y)
+			hspan_copy(fb, cx - ko + 1, cx + ko - 1, cy - y);
+		} else {
+		    hspan_copy(fb, cx + ei, cx + ko - 1, cy + y);
+		    hspan_copy(fb, cx - ko + 1, cx - ei, cy + y);
+		    if (y) {
+			hspan_copy(fb, cx + ei, cx + ko - 1, cy - y);
+			hspan_copy(fb, cx - ko + 1, cx - ei, cy - y);
+		    }
+		}
+		x = ko - 1;
+		continue;
+	    }
+	    for (int q = 0; q < 4; q++) {
+		const int dx = q & 1 ? -x : x;
+		const int dy = q & 2 ? -y : y;
+		if ((q & 1 && !x) || (q & 2 && !y))
+		    continue;
+		if (arc && !arc_inside(arc, dx, dy))
+		    continue;
+		if (255 == a)
+		    fb->setpixel_copy(fb, cx + dx, cy + dy);
+		else
+		    fb->blendpixel(fb, cx + dx, cy + dy, a);
+	    }
+	}
+    }
+}
+
+/**
+ * @brief Draw an anti-aliased ring with edges at the radii @p r1 and @p r2 (24.8 fixed point)
+ */
+static void aaring(sfb_t* fb, int x, int y, int r1, int r2, const ellipse_t* arc)
+{
+    int jbuf[2][130];
+    uint8_t abuf[2][130];
+    const int n = (MAX(r1, r2) >> 8) + 2;
+    octant_t oo = { 0, jbuf[0], abuf[0] };
+    octant_t oi = { 0, jbuf[1], abuf[1] };
+
+    if (n > 130) {
+	oo.jb = (int *)malloc(2 * n * sizeof(int));
+	oo.a = (uint8_t *)malloc(2 * n);
+	if (!oo.jb || !oo.a) {
+	    error(fb, "Error: insufficient memory for radius %d", n);
+	    free(oo.a);
+	    free(oo.jb);
+	    return;
+	}
+	oi.jb = oo.jb + n;
+	oi.a = oo.a + n;
+    }
+
+    octant_init(&oo, MAX(r1, r2));
+    octant_init(&oi, MIN(r1, r2));
+    ring_emit(fb, x, y, &oo, &oi, arc);
+
+    if (n > 130) {
+	free(oo.a);
+	free(oo.jb);
+    }
+}
+
+/**
+ * @brief Draw an anti-aliased circle at @p x, @p y with radius @p r
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_aacircle(sfb_t *fb, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    if (r < 0)
+	return;
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r = xform_len(fb->xr, r);
+    }
+    aaring(fb, x, y, r * 256 + 128, r * 256 - 128, NULL);
+}
+
+/**
+ * @brief Draw an anti-aliased disc at @p x, @p y with radius @p r
+ *
+ * The disc covers the same pixels as @ref fb_disc() plus a smooth
+ * edge. Its interior is drawn with the copy span kernel.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ */
+void fb_aadisc(sfb_t *fb, int x, int y, int r)
+{
+    CHECK_FB(fb);
+    if (r < 0)
+	return;
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r = xform_len(fb->xr, r);
+    }
+    aaring(fb, x, y, r * 256 + 128, -1, NULL);
+}
+
+/**
+ * @brief Draw an anti-aliased ring at @p x, @p y between the radii @p r1 and @p r2
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r1 outer radius in pixels
+ * @param r2 inner radius in pixels
+ */
+void fb_aaring(sfb_t *fb, int x, int y, int r1, int r2)
+{
+    CHECK_FB(fb);
+    if (r1 < r2) {
+	const int t = r1;
+	r1 = r2;
+	r2 = t;
+    }
+    if (r1 < 0)
+	return;
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r1 = xform_len(fb->xr, r1);
+	r2 = xform_len(fb->xr, r2);
+    }
+    aaring(fb, x, y, r1 * 256 + 128, r2 * 256 - 128, NULL);
+}
+
+/**
+ * @brief Draw an anti-aliased circular arc at @p x, @p y with radius @p r
+ *
+ * Angles are in degrees like for @ref fb_arc().
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x center x coordinate
+ * @param y center y coordinate
+ * @param r radius in pixels
+ * @param start start angle in degrees
+ * @param end end angle in degrees
+ */
+void fb_aaarc(sfb_t *fb, int x, int y, int r, int start, int end)
+{
+    CHECK_FB(fb);
+    if (r < 0)
+	return;
+
+    int sweep = (end - start) % 360;
+    if (sweep < 0)
+	sweep += 360;
+    if (0 == sweep) {
+	if (end != start)
+	    fb_aacircle(fb, x, y, r);
+	return;
+    }
+    if (fb->xform) {
+	xform_point(fb, &x, &y);
+	r = xform_len(fb->xr, r);
+    }
+
+    const ellipse_t e = {
+	.x = x, .y = y, .rx = r, .ry = r,
+	.sx = icos(start), .sy = isin(start),
+	.ex = icos(end), .ey = isin(end),
+	.wide = sweep > 180
+    };
+    aaring(fb, x, y, r * 256 + 128, r * 256 - 128, &e);
+}
+
+/**
+ * @brief Polygon edge in the edge table and active edge list
+ *
+ * Vertices are at pixel centers. An edge covers the scan lines
+ * @p y1 up to but not including @p y2, and a span covers the pixels
+ * from the left edge up to but not including the right edge. This
+ * way shared edges of adjacent polygons are filled only once.
+ */
+typedef struct {
+    int y1;			/*!< first scan line */
+    int y2;			/*!< last scan line + 1 */
+    int64_t x;			/*!< 16.16 x coordinate at the current scan line */
+    int64_t dx;			/*!< 16.16 x increment per scan line */
+    int dir;			/*!< winding direction (+1 downward, -1 upward) */
+}   edge_t;
+
+/**
+ * @brief Set up an edge from @p x0, @p y0 to @p x1, @p y1 (16.16 fixed point)
+ *
+ * The coordinates are 64 bit, so vertices beyond ±32767 pixels do not
+ * overflow the fixed point setup.
+ *
+ * @param e pointer to the edge to initialize
+ * @return 1 if the edge crosses at least one scan line, 0 otherwise
+ */
+static int edge_init(edge_t* e, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    int dir = 1;
+    if (y0 > y1) {
+	int64_t t;
+	t = x0; x0 = x1; x1 = t;
+	t = y0; y0 = y1; y1 = t;
+	dir = -1;
+    }
+    const int ys = (int)((y0 + 0xffff) >> 16);
+    const int ye = (int)((y1 + 0xffff) >> 16);
+    if (ys >= ye)
+	return 0;
+
+    const int64_t dxdy = (x1 - x0) * 65536 / (y1 - y0);
+    e->y1 = ys;
+    e->y2 = ye;
+    e->dx = dxdy;
+    e->x = x0 + ((((int64_t)ys * 65536 - y0) * dxdy) >> 16);
+    e->dir = dir;
+    return 1;
+}
+
+static int edge_cmp(const void* a, const void* b)
+{
+    const edge_t* ea = (const edge_t *)a;
+    const edge_t* eb = (const edge_t *)b;
+    return ea->y1 - eb->y1;
+}
+
+/**
+ * @brief Scan convert the edge table @p et with @p n edges
+ *
+ * The edges are sorted by their first scan line, then an active edge
+ * list is stepped down the scan lines. Spans inside the polygon
+ * according to @p rule go straight to the frame buffer's hline kernel.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param et edge table
+ * @param n number of edges
+ * @param rule fill rule
+ */
+static void edges_fill(sfb_t* fb, edge_t* et, int n, fill_rule_e rule)
+{
+    edge_t* abuf[32];
+    edge_t** ael = abuf;
+
+    if (n < 2)
+	return;
+    if (n > (int)(sizeof(abuf) / sizeof(abuf[0]))) {
+	ael = (edge_t **)calloc(n, sizeof(edge_t *));
+	if (NULL == ael) {
+	    error(fb, "Error: insufficient memory for %d edges", n);
+	    return;
+	}
+    }
+
+    qsort(et, n, sizeof(edge_t), edge_cmp);
+    int ymax = et[0].y2;
+    for (int i = 1; i < n; i++)
+	ymax = MAX(ymax, et[i].y2);
+    ymax = MIN(ymax, fb->h);
+    const int64_t xmax = (int64_t)fb->w * 65536;
+
+    int na = 0;
+    int next = 0;
+    for (int y = MAX(et[0].y1, 0); y < ymax; y++) {
+	/* retire finished edges */
+	int j = 0;
+	for (int i = 0; i < na; i++) {
+	    if (ael[i]->y2 > y)
+		ael[j++] = ael[i];
+	}
+	na = j;
+
+	/* activate edges starting at (or above, if clipped) this scan line */
+	while (next < n && et[next].y1 <= y) {
+	    edge_t* e = &et[next++];
+	    if (e->y2 <= y)
+		continue;
+	    if (e->y1 < y)
+		e->x += (y - e->y1) * e->dx;
+	    ael[na++] = e;
+	}
+
+	if (0 == na) {
+	    if (next >= n)
+		break;
+	    y = et[next].y1 - 1;
+	    continue;
+	}
+
+	/* insertion sort by x; the list stays almost sorted between lines */
+	for (int i = 1; i < na; i++) {
+	    edge_t* e = ael[i];
+	    int k = i - 1;
+	    while (k >= 0 && ael[k]->x > e->x) {
+		ael[k+1] = ael[k];
+		k--;
+	    }
+	    ael[k+1] = e;
+	}
+
+	int wind = 0;
+	int64_t xs = 0;
+	for (int i = 0; i < na; i++) {
+	    const int was = rule == fill_non_zero ? wind != 0 : wind & 1;
+	    wind += ael[i]->dir;
+	    const int is = rule == fill_non_zero ? wind != 0 : wind & 1;
+	    if (!was && is) {
+		xs = ael[i]->x;
+	    } else if (was && !is) {
+		/* the span ends are clamped to the frame buffer first */
+		const int x1 = (int)((BOUND(xs, 0, xmax) + 0xffff) >> 16);
+		const int x2 = (int)((BOUND(ael[i]->x, 0, xmax) + 0xffff) >> 16);
+		if (x2 > x1)
+		    fb->fillspan(fb, x1, y, x2 - x1);
+	    }
+	}
+
+	for (int i = 0; i < na; i++)
+	    ael[i]->x += ael[i]->dx;
+    }
+
+    if (ael != abuf)
+	free(ael);
+}
+
+/**
+ * @brief Draw the outline of a closed polygon
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of vertices
+ * @param n number of vertices
+ */
+void fb_polygon(sfb_t *fb, const point_t* points, int n)
+{
+    CHECK_FB(fb);
+    if (n < 1)
+	return;
+    if (1 == n) {
+	plot(fb, points[0].x, points[0].y);
+	return;
+    }
+    for (int i = 0; i < n; i++) {
+	const point_t* p1 = &points[i];
+	const point_t* p2 = &points[(i + 1) % n];
+	fb_line(fb, p1->x, p1->y, p2->x, p2->y);
+    }
+}
+
+/**
+ * @brief Fill a closed, possibly concave or self-intersecting polygon
+ *
+ * The whole polygon is scan converted in one pass with an edge table
+ * and an active edge list.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of vertices
+ * @param n number of vertices
+ * @param rule fill rule (even-odd or non-zero winding)
+ */
+void fb_polygon_fill(sfb_t *fb, const point_t* points, int n, fill_rule_e rule)
+{
+    CHECK_FB(fb);
+    edge_t ebuf[32];
+    edge_t* et = ebuf;
+
+    if (n < 3)
+	return;
+    if (n > (int)(sizeof(ebuf) / sizeof(ebuf[0]))) {
+	et = (edge_t *)calloc(n, sizeof(edge_t));
+	if (NULL == et) {
+	    error(fb, "Error: insufficient memory for %d edges", n);
+	    return;
+	}
+    }
+
+    int ne = 0;
+    for (int i = 0; i < n; i++) {
+	const point_t* p1 = &points[i];
+	const point_t* p2 = &points[(i + 1) % n];
+	if (fb->xform) {
+	    int64_t x1, y1, x2, y2;
+	    xform_fixed(fb, p1->x, p1->y, &x1, &y1);
+	    xform_fixed(fb, p2->x, p2->y, &x2, &y2);
+	    ne += edge_init(&et[ne], x1, y1, x2, y2);
+	    continue;
+	}
+	ne += edge_init(&et[ne],
+	    (int64_t)p1->x * 65536, (int64_t)p1->y * 65536,
+	    (int64_t)p2->x * 65536, (int64_t)p2->y * 65536);
+    }
+    edges_fill(fb, et, ne, rule);
+
+    if (et != ebuf)
+	free(et);
+}
+
+/**
+ * @brief Fill the quadrilateral with the 16.16 pixel corner coordinates @p xy
+ */
+static void fill_quad(sfb_t* fb, const int32_t* xy)
+{
+    edge_t et[4];
+    int ne = 0;
+
+    /* edges are at pixel centers, corners half a pixel up and left of them */
+    for (int i = 0; i < 4; i++) {
+	const int j = (i + 1) % 4;
+	ne += edge_init(&et[ne],
+	    xy[2*i] - 0x8000, xy[2*i+1] - 0x8000,
+	    xy[2*j] - 0x8000, xy[2*j+1] - 0x8000);
+    }
+    edges_fill(fb, et, ne, fill_non_zero);
+}
+
+/**
+ * @brief Triangle vertex in 28.4 fixed point device coordinates
+ */
+typedef struct {
+    int32_t x;
+    int32_t y;
+    argb_t color;
+}   tvertex_t;
+
+/**
+ * @brief Edge function E(x, y) = a x + b y + c of a triangle edge
+ *
+ * E is positive inside the triangle. @p bias is -1 for edges that are
+ * neither top nor left edges, so pixels exactly on them are left to
+ * the neighbouring triangle.
+ */
+typedef struct {
+    int64_t a, b, c;
+    int bias;
+}   tedge_t;
+
+/**
+ * @brief Set up the edge function from @p v0 to @p v1 (pixel units)
+ */
+static void tedge_init(tedge_t* e, const tvertex_t* v0, const tvertex_t* v1)
+{
+    const int64_t dx = v1->x - v0->x;
+    const int64_t dy = v1->y - v0->y;
+    /* E(P) = dx (P.y - v0.y) - dy (P.x - v0.x), P in pixels, E in 1/256 */
+    e->a = -dy * 16;
+    e->b = dx * 16;
+    e->c = dy * v0->x - dx * v0->y;
+    e->bias = (dy < 0 || (0 == dy && dx > 0)) ? 0 : -1;
+}
+
+/**
+ * @brief Floor of @p n / @p d for @p d > 0
+ */
+static inline int64_t floor_div(int64_t n, int64_t d)
+{
+    return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+/**
+ * @brief Narrow the span x0 … x1 on row @p y to where the edge function is inside
+ */
+static void tedge_span(const tedge_t* e, int y, int* x0, int* x1)
+{
+    /* inside means a x + r >= 0 */
+    const int64_t r = e->b * y + e->c + e->bias;
+    if (e->a > 0) {
+	const int64_t x = -floor_div(r, e->a);
+	if (x > *x0)
+	    *x0 = x > *x1 ? *x1 + 1 : (int)x;
+    } else if (e->a < 0) {
+	const int64_t x = floor_div(r, -e->a);
+	if (x < *x1)
+	    *x1 = x < *x0 ? *x0 - 1 : (int)x;
+    } else if (r < 0) {
+	*x1 = *x0 - 1;
+    }
+}
+
+/**
+ * @brief Rasterize one triangle with per-vertex colors
+ *
+ * The three edge functions give the span of each row directly, and
+ * the color channels are planes stepped along the span in 16.16 fixed
+ * point. Triangles of one color skip the interpolation; opaque ones
+ * are drawn with the copy hline kernel.
+ */
+static void triangle_draw(sfb_t* fb, const tvertex_t* v0, const tvertex_t* v1, const tvertex_t* v2)
+{
+    int64_t area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) -
+	(int64_t)(v2->x - v0->x) * (v1->y - v0->y);
+    if (0 == area)
+	return;
+    if (area < 0) {
+	const tvertex_t* t = v1;
+	v1 = v2;
+	v2 = t;
+	area = -area;
+    }
+
+    tedge_t e[3];
+    tedge_init(&e[0], v0, v1);
+    tedge_init(&e[1], v1, v2);
+    tedge_init(&e[2], v2, v0);
+
+    /* rows whose centers can be inside, clipped to the frame buffer */
+    const int32_t ymin = MIN(v0->y, MIN(v1->y, v2->y));
+    const int32_t ymax = MAX(v0->y, MAX(v1->y, v2->y));
+    const int32_t xmin = MIN(v0->x, MIN(v1->x, v2->x));
+    const int32_t xmax = MAX(v0->x, MAX(v1->x, v2->x));
+    const int y0 = MAX(0, (ymin + 15) >> 4);
+    const int y1 = MIN(fb->h - 1, ymax >> 4);
+    const int bx0 = MAX(0, (xmin + 15) >> 4);
+    const int bx1 = MIN(fb->w - 1, xmax >> 4);
+    if (y0 > y1 || bx0 > bx1)
+	return;
+
+    const int flat = v0->color == v1->color && v0->color == v2->color;
+    const int dither = fb->dither && 16 == fb->bpp;
+    const color_t fg = fb->fgcolor;
+    argb_t row[256];
+
+    if (flat && 0xff000000u == (v0->color & 0xff000000u) && !dither) {
+	const argb_t c = v0->color;
+	fb->fgcolor = fb->rgb2pix((c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+	for (int y = y0; y <= y1; y++) {
+	    int xa = bx0, xb = bx1;
+	    for (int i = 0; i < 3; i++)
+		tedge_span(&e[i], y, &xa, &xb);
+	    if (xa <= xb)
+		fb->hline_copy(fb, xa, y, xb + 1 - xa);
+	}
+	fb->fgcolor = fg;
+	return;
+    }
+
+    /* color planes: C(x, y) = c0 + gx (x - x0) + gy (y - y0) in 16.16 */
+    int32_t gx[4] = { 0, 0, 0, 0 }, gy[4] = { 0, 0, 0, 0 };
+    int32_t c0[4];
+    const float fa = (float)area / 256.0f;
+    const float dx1 = (v1->x - v0->x) / 16.0f, dy1 = (v1->y - v0->y) / 16.0f;
+    const float dx2 = (v2->x - v0->x) / 16.0f, dy2 = (v2->y - v0->y) / 16.0f;
+    for (int c = 0; c < 4; c++) {
+	const int s = 8 * c;
+	c0[c] = (int32_t)((v0->color >> s) & 0xff) << 16;
+	if (flat)
+	    continue;
+	const float d1 = (float)(int)((v1->color >> s) & 0xff) - (float)(int)((v0->color >> s) & 0xff);
+	const float d2 = (float)(int)((v2->color >> s) & 0xff) - (float)(int)((v0->color >> s) & 0xff);
+	gx[c] = (int32_t)lrintf((d1 * dy2 - d2 * dy1) / fa * 65536.0f);
+	gy[c] = (int32_t)lrintf((d2 * dx1 - d1 * dx2) / fa * 65536.0f);
+    }
+
+    for (int y = y0; y <= y1; y++) {
+	int xa = bx0, xb = bx1;
+	for (int i = 0; i < 3; i++)
+	    tedge_span(&e[i], y, &xa, &xb);
+	for (int x = xa; x <= xb; x += 256) {
+	    const int n = MIN(xb + 1 - x, 256);
+	    int32_t v[4];
+	    for (int c = 0; c < 4; c++)
+		v[c] = c0[c] + 0x8000 + (int32_t)(((int64_t)gx[c] * (x * 16 - v0->x) +
+		    (int64_t)gy[c] * (y * 16 - v0->y)) >> 4);
+	    for (int i = 0; i < n; i++) {
+		argb_t p = 0;
+		for (int c = 0; c < 4; c++) {
+		    const int32_t t = v[c];
+		    p |= (argb_t)(t < 0 ? 0 : t > 0xffffff ? 0xff : t >> 16) << (8 * c);
+		    v[c] += gx[c];
+		}
+		row[i] = p;
+	    }
+	    if (dither)
+		dither_row(row, x, y, n);
+	    fb->blendspan(fb, x, y, row, n);
+	}
+    }
+}
+
+/**
+ * @brief Draw a triangle with colors interpolated between its vertices
+ *
+ * See @ref fb_triangle_mesh().
+ *
+ * @param fb pointer to the frame buffer context
+ * @param v array of three vertices
+ */
+void fb_triangle(sfb_t* fb, const vertex_t* v)
+{
+    fb_triangle_mesh(fb, v, 3, NULL, 1);
+}
+
+/**
+ * @brief Draw a mesh of triangles with colors interpolated between their vertices
+ *
+ * Every vertex is mapped through the transform and converted to 28.4
+ * fixed point once, no matter how many triangles share it. Pixels
+ * whose center is inside a triangle are drawn, and pixels exactly on
+ * an edge belong to the triangle left of or below it (top-left rule),
+ * so triangles sharing an edge never draw a pixel twice. The colors
+ * are premultiplied ARGB and composited over the frame buffer. At
+ * 16 bpp the result is dithered if enabled with @ref fb_set_dither().
+ * Triangles ignore the raster operation and the brush: opaque triangles
+ * of one color are stored with the copy hline kernel, which gives the
+ * same pixels as compositing them.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param v array of @p nv vertices
+ * @param nv number of vertices
+ * @param index array of 3 * @p ntri vertex indices, or NULL to use the vertices in order
+ * @param ntri number of triangles
+ */
+void fb_triangle_mesh(sfb_t* fb, const vertex_t* v, int nv, const int* index, int ntri)
+{
+    CHECK_FB(fb);
+    tvertex_t vbuf[48];
+    tvertex_t* tv = vbuf;
+
+    if (!v || nv < 3 || ntri <= 0)
+	return;
+    if (nv > (int)(sizeof(vbuf) / sizeof(vbuf[0]))) {
+	tv = (tvertex_t *)malloc(nv * sizeof(tvertex_t));
+	if (NULL == tv) {
+	    error(fb, "Error: insufficient memory for %d vertices", nv);
+	    return;
+	}
+    }
+
+    for (int i = 0; i < nv; i++) {
+	if (fb->xform) {
+	    int64_t fx, fy;
+	    xform_fixed(fb, v[i].x, v[i].y, &fx, &fy);
+	    tv[i].x = (int32_t)((fx + 0x800) >> 12);
+	    tv[i].y = (int32_t)((fy + 0x800) >> 12);
+	} else {
+	    tv[i].x = v[i].x * 16;
+	    tv[i].y = v[i].y * 16;
+	}
+	tv[i].color = v[i].color;
+    }
+
+    for (int t = 0; t < ntri; t++) {
+	int i0 = 3 * t, i1 = 3 * t + 1, i2 = 3 * t + 2;
+	if (index) {
+	    i0 = index[i0];
+	    i1 = index[i1];
+	    i2 = index[i2];
+	}
+	if ((unsigned)i0 >= (unsigned)nv || (unsigned)i1 >= (unsigned)nv || (unsigned)i2 >= (unsigned)nv)
+	    continue;
+	triangle_draw(fb, &tv[i0], &tv[i1], &tv[i2]);
+    }
+
+    if (tv != vbuf)
+	free(tv);
+}
+
+/**
+ * @brief Maximum distance of a flattened curve from the true curve in pixels
+ */
+#define	PATH_TOLERANCE	0.25f
+
+/**
+ * @brief Number of scan lines the path rasterizer accumulates at once
+ */
+#define	PATH_BAND	16
+
+/**
+ * @brief A point with sub-pixel coordinates
+ */
+typedef struct {
+    float x;
+    float y;
+}   fpoint_t;
+
+/**
+ * @brief A contour (sub-path) of a path
+ */
+typedef struct {
+    int first;			/*!< index of the first point */
+    int n;			/*!< number of points */
+    int closed;			/*!< non zero if the contour was closed */
+}   contour_t;
+
+typedef struct sfb_path_s {
+    /** @brief flattened points of all contours */
+    fpoint_t* pt;
+
+    /** @brief number of points used */
+    int npt;
+
+    /** @brief number of points allocated */
+    int spt;
+
+    /** @brief contours */
+    contour_t* ct;
+
+    /** @brief number of contours used */
+    int nct;
+
+    /** @brief number of contours allocated */
+    int sct;
+
+    /** @brief bounding box of all points */
+    float x1, y1, x2, y2;
+}   sfb_path_t;
+
+/**
+ * @brief A path segment with sub-pixel coordinates
+ */
+typedef struct {
+    float x0, y0;		/*!< start point */
+    float x1, y1;		/*!< end point */
+    float ymin, ymax;		/*!< vertical extent */
+}   pseg_t;
+
+/**
+ * @brief Append a point to the current contour of @p path
+ * @return 0 on success, -1 if out of memory or there is no contour
+ */
+static int path_push(sfb_path_t* path, float x, float y)
+{
+    if (0 == path->nct)
+	return -1;
+    if (path->npt >= path->spt) {
+	const int size = path->spt ? path->spt * 2 : 64;
+	fpoint_t* pt = (fpoint_t *)realloc(path->pt, size * sizeof(fpoint_t));
+	if (NULL == pt)
+	    return -1;
+	path->pt = pt;
+	path->spt = size;
+    }
+    if (0 == path->npt) {
+	path->x1 = path->x2 = x;
+	path->y1 = path->y2 = y;
+    } else {
+	path->x1 = MIN(path->x1, x);
+	path->y1 = MIN(path->y1, y);
+	path->x2 = MAX(path->x2, x);
+	path->y2 = MAX(path->y2, y);
+    }
+    path->pt[path->npt].x = x;
+    path->pt[path->npt].y = y;
+    path->npt++;
+    path->ct[path->nct - 1].n++;
+    return 0;
+}
+
+/**
+ * @brief Get the current point of @p path, starting a contour at 0, 0 if there is none
+ * @return 0 on success, -1 if out of memory
+ */
+static int path_current(sfb_path_t* path, fpoint_t* p)
+{
+    if (0 == path->nct || 0 == path->ct[path->nct - 1].n)
+	if (fb_path_moveto(path, 0.0f, 0.0f) < 0)
+	    return -1;
+    if (0 == path->npt)
+	return -1;
+    *p = path->pt[path->npt - 1];
+    return 0;
+}
+
+/**
+ * @brief Create a new, empty path
+ * @param ppath pointer to the path pointer
+ * @return 0 on success, or < 0 on error
+ */
+int fb_path_init(struct sfb_path_s** ppath)
+{
+    if (!ppath)
+	return -1;
+    *ppath = (sfb_path_t *)calloc(1, sizeof(sfb_path_t));
+    return *ppath ? 0 : -1;
+}
+
+/**
+ * @brief Free a path
+ * @param ppath pointer to the path pointer
+ */
+void fb_path_exit(struct sfb_path_s** ppath)
+{
+    if (!ppath || !*ppath)
+	return;
+    sfb_path_t* path = *ppath;
+    *ppath = NULL;
+    free(path->pt);
+    free(path->ct);
+    free(path);
+}
+
+/**
+ * @brief Remove all contours from a path, keeping its memory
+ * @param path pointer to the path
+ */
+void fb_path_reset(sfb_path_t* path)
+{
+    if (!path)
+	return;
+    path->npt = 0;
+    path->nct = 0;
+}
+
+/**
+ * @brief Start a new contour at @p x, @p y
+ * @param path pointer to the path
+ * @param x x coordinate
+ * @param y y coordinate
+ * @return 0 on success, or < 0 on error
+ */
+int fb_path_moveto(sfb_path_t* path, float x, float y)
+{
+    if (!path)
+	return -1;
+    if (0 == path->nct || path->ct[path->nct - 1].n > 1) {
+	if (path->nct >= path->sct) {
+	    const int size = path->sct ? path->sct * 2 : 8;
+	    contour_t* ct = (contour_t *)realloc(path->ct, size * sizeof(contour_t));
+	    if (NULL == ct)
+		return -1;
+	    path->ct = ct;
+	    path->sct = size;
+	}
+	path->nct++;
+    } else {
+	/* replace a lonely moveto */
+	path->npt -= path->ct[path->nct - 1].n;
+    }
+    contour_t* c = &path->ct[path->nct - 1];
+    c->first = path->npt;
+    c->n = 0;
+    c->closed = 0;
+    return path_push(path, x, y);
+}
+
+/**
+ * @brief Add a straight line from the current point to @p x, @p y
+ * @param path pointer to the path
+ * @param x x coordinate
+ * @param y y coordinate
+ */
+void fb_path_lineto(sfb_path_t* path, float x, float y)
+{
+    fpoint_t p;
+    if (!path || path_current(path, &p) < 0)
+	return;
+    path_push(path, x, y);
+}
+
+/**
+ * @brief Number of points of a flattened Bézier curve kept on the stack
+ *
+ * Curves that need more segments are flattened into a heap buffer.
+ */
+#define	BEZIER_STACK	256
+
+/**
+ * @brief Maximum number of segments of a flattened Bézier curve
+ *
+ * Only control points hundreds of millions of pixels apart need more;
+ * such curves are flattened coarser than @ref PATH_TOLERANCE.
+ */
+#define	BEZIER_MAX	65536
+
+/**
+ * @brief Forward differencing state of a quadratic or cubic Bézier curve
+ *
+ * The differences are kept in double precision, so the error does not
+ * build up over thousands of steps.
+ */
+typedef struct {
+    double x, y;		/*!< current point */
+    double dx, dy;		/*!< first differences */
+    double ddx, ddy;		/*!< second differences */
+    double dddx, dddy;		/*!< third differences (cubic only) */
+    fpoint_t end;		/*!< end point, returned exactly by the last step */
+    int i;			/*!< steps taken */
+    int n;			/*!< number of segments */
+}   bezier_t;
+
+/**
+ * @brief Set up @p b to flatten the quadratic (@p degree 2) or cubic (@p degree 3) curve @p p
+ *
+ * The number of segments is the smallest one that keeps the polyline
+ * within @ref PATH_TOLERANCE of the curve, from the largest second
+ * difference of the control points (Wang's formula).
+ *
+ * @return number of segments, at most @ref BEZIER_MAX; more are needed if equal
+ */
+static int bezier_init(bezier_t* b, const fpoint_t* p, int degree)
+{
+    float dd, n;
+
+    dd = hypotf(p[0].x - 2.0f * p[1].x + p[2].x, p[0].y - 2.0f * p[1].y + p[2].y);
+    if (2 == degree) {
+	n = ceilf(sqrtf(dd / (4.0f * PATH_TOLERANCE)));
+    } else {
+	dd = MAX(dd, hypotf(p[1].x - 2.0f * p[2].x + p[3].x, p[1].y - 2.0f * p[2].y + p[3].y));
+	n = ceilf(sqrtf(0.75f * dd / PATH_TOLERANCE));
+    }
+    /* NaN and infinity from absurd coordinates end up at the maximum */
+    b->n = n < (float)BEZIER_MAX ? MAX(1, (int)n) : BEZIER_MAX;
+    b->i = 0;
+    b->end = p[degree];
+
+    const double h = 1.0 / b->n;
+    b->x = p[0].x;
+    b->y = p[0].y;
+    if (2 == degree) {
+	/* B(t) = a t² + c t + p0 */
+	const double ax = p[0].x - 2.0 * p[1].x + p[2].x;
+	const double ay = p[0].y - 2.0 * p[1].y + p[2].y;
+	const double cx = 2.0 * ((double)p[1].x - p[0].x);
+	const double cy = 2.0 * ((double)p[1].y - p[0].y);
+	b->dx = ax * h * h + cx * h;
+	b->dy = ay * h * h + cy * h;
+	b->ddx = 2.0 * ax * h * h;
+	b->ddy = 2.0 * ay * h * h;
+	b->dddx = 0.0;
+	b->dddy = 0.0;
+    } else {
+	/* B(t) = a t³ + c t² + e t + p0 */
+	const double ax = -p[0].x + 3.0 * p[1].x - 3.0 * p[2].x + p[3].x;
+	const double ay = -p[0].y + 3.0 * p[1].y - 3.0 * p[2].y + p[3].y;
+	const double cx = 3.0 * p[0].x - 6.0 * p[1].x + 3.0 * p[2].x;
+	const double cy = 3.0 * p[0].y - 6.0 * p[1].y + 3.0 * p[2].y;
+	const double ex = 3.0 * ((double)p[1].x - p[0].x);
+	const double ey = 3.0 * ((double)p[1].y - p[0].y);
+	b->dx = ax * h * h * h + cx * h * h + ex * h;
+	b->dy = ay * h * h * h + cy * h * h + ey * h;
+	b->ddx = 6.0 * ax * h * h * h + 2.0 * cx * h * h;
+	b->ddy = 6.0 * ay * h * h * h + 2.0 * cy * h * h;
+	b->dddx = 6.0 * ax * h * h * h;
+	b->dddy = 6.0 * ay * h * h * h;
+    }
+    return b->n;
+}
+
+/**
+ * @brief Return the next point of the flattened curve, after the start point
+ */
+static fpoint_t bezier_next(bezier_t* b)
+{
+    if (++b->i >= b->n)
+	return b->end;
+    b->x += b->dx;
+    b->y += b->dy;
+    b->dx += b->ddx;
+    b->dy += b->ddy;
+    b->ddx += b->dddx;
+    b->ddy += b->dddy;
+    const fpoint_t pt = { (float)b->x, (float)b->y };
+    return pt;
+}
+
+/**
+ * @brief Add a quadratic Bézier curve from the current point to @p x, @p y
+ * @param path pointer to the path
+ * @param x1 control point x coordinate
+ * @param y1 control point y coordinate
+ * @param x end point x coordinate
+ * @param y end point y coordinate
+ */
+void fb_path_quadto(sfb_path_t* path, float x1, float y1, float x, float y)
+{
+    fpoint_t p[3] = { { 0.0f, 0.0f }, { x1, y1 }, { x, y } };
+    if (!path || path_current(path, &p[0]) < 0)
+	return;
+    bezier_t b;
+    const int n = bezier_init(&b, p, 2);
+
+    for (int i = 0; i < n; i++) {
+	const fpoint_t pt = bezier_next(&b);
+	if (path_push(path, pt.x, pt.y) < 0)
+	    return;
+    }
+}
+
+/**
+ * @brief Add a cubic Bézier curve from the current point to @p x, @p y
+ * @param path pointer to the path
+ * @param x1 first control point x coordinate
+ * @param y1 first control point y coordinate
+ * @param x2 second control point x coordinate
+ * @param y2 second control point y coordinate
+ * @param x end point x coordinate
+ * @param y end point y coordinate
+ */
+void fb_path_cubicto(sfb_path_t* path, float x1, float y1, float x2, float y2, float x, float y)
+{
+    fpoint_t p[4] = { { 0.0f, 0.0f }, { x1, y1 }, { x2, y2 }, { x, y } };
+    if (!path || path_current(path, &p[0]) < 0)
+	return;
+    bezier_t b;
+    const int n = bezier_init(&b, p, 3);
+
+    for (int i = 0; i < n; i++) {
+	const fpoint_t pt = bezier_next(&b);
+	if (path_push(path, pt.x, pt.y) < 0)
+	    return;
+    }
+}
+
+/**
+ * @brief Close the current contour
+ * @param path pointer to the path
+ */
+void fb_path_close(sfb_path_t* path)
+{
+    if (!path || 0 == path->nct)
+	return;
+    path->ct[path->nct - 1].closed = 1;
+}
+
+/**
+ * @brief Accumulate the signed area of a line into the buffer @p acc
+ *
+ * The line must lie inside 0 <= x <= stride - 2 and inside the rows
+ * of the buffer. Each cell receives the change of coverage caused by
+ * the line, so a prefix sum along a row yields the coverage.
+ *
+ * @param acc accumulation buffer
+ * @param stride number of cells per row
+ * @param x0 start x coordinate
+ * @param y0 start y coordinate
+ * @param x1 end x coordinate
+ * @param y1 end y coordinate
+ */
+static void acc_line(float* acc, int stride, float x0, float y0, float x1, float y1)
+{
+    float dir = 1.0f;
+    if (y0 == y1)
+	return;
+    if (y0 > y1) {
+	float t;
+	t = x0; x0 = x1; x1 = t;
+	t = y0; y0 = y1; y1 = t;
+	dir = -1.0f;
+    }
+
+    const float dxdy = (x1 - x0) / (y1 - y0);
+    const int ye = (int)ceilf(y1);
+    float x = x0;
+    for (int y = (int)y0; y < ye; y++) {
+	float* row = acc + y * stride;
+	const float dy = MIN((float)(y + 1), y1) - MAX((float)y, y0);
+	const float xnext = x + dxdy * dy;
+	const float d = dy * dir;
+	const float xa = MIN(x, xnext);
+	const float xb = MAX(x, xnext);
+	const float xaf = floorf(xa);
+	const int xai = (int)xaf;
+	const float xbc = ceilf(xb);
+	const int xbi = (int)xbc;
+
+	if (xbi <= xai + 1) {
+	    /* the line stays inside one pixel column */
+	    const float xmf = 0.5f * (x + xnext) - xaf;
+	    row[xai] += d - d * xmf;
+	    row[xai+1] += d * xmf;
+	} else {
+	    const float s = 1.0f / (xb - xa);
+	    const float xa_f = xa - xaf;
+	    const float a0 = 0.5f * s * (1.0f - xa_f) * (1.0f - xa_f);
+	    const float xb_f = xb - xbc + 1.0f;
+	    const float am = 0.5f * s * xb_f * xb_f;
+	    row[xai] += d * a0;
+	    if (xbi == xai + 2) {
+		row[xai+1] += d * (1.0f - a0 - am);
+	    } else {
+		const float a1 = s * (1.5f - xa_f);
+		row[xai+1] += d * (a1 - a0);
+		for (int xi = xai + 2; xi < xbi - 1; xi++)
+		    row[xi] += d * s;
+		const float a2 = a1 + (xbi - xai - 3) * s;
+		row[xbi-1] += d * (1.0f - a2 - am);
+	    }
+	    row[xbi] += d * am;
+	}
+	x = xnext;
+    }
+}
+
+/**
+ * @brief Clip a line to 0 <= x <= @p w and accumulate it
+ *
+ * Parts left of 0 or right of @p w become vertical lines on the border,
+ * which keeps their winding contribution for the cells to their right.
+ */
+static void acc_clip(float* acc, int stride, float w, float x0, float y0, float x1, float y1)
+{
+    if ((x0 < 0.0f && x1 > 0.0f) || (x0 > 0.0f && x1 < 0.0f)) {
+	const float ym = y0 + (0.0f - x0) * (y1 - y0) / (x1 - x0);
+	acc_clip(acc, stride, w, x0, y0, 0.0f, ym);
+	acc_clip(acc, stride, w, 0.0f, ym, x1, y1);
+	return;
+    }
+    if ((x0 < w && x1 > w) || (x0 > w && x1 < w)) {
+	const float ym = y0 + (w - x0) * (y1 - y0) / (x1 - x0);
+	acc_clip(acc, stride, w, x0, y0, w, ym);
+	acc_clip(acc, stride, w, w, ym, x1, y1);
+	return;
+    }
+    acc_line(acc, stride,
+	BOUND(x0, 0.0f, w), y0,
+	BOUND(x1, 0.0f, w), y1);
+}
+
+static int pseg_cmp(const void* a, const void* b)
+{
+    const pseg_t* sa = (const pseg_t *)a;
+    const pseg_t* sb = (const pseg_t *)b;
+    return sa->ymin < sb->ymin ? -1 : sa->ymin > sb->ymin ? 1 : 0;
+}
+
+/**
+ * @brief Fill @p path in device coordinates, see @ref fb_path_fill()
+ */
+static void path_fill(sfb_t* fb, const sfb_path_t* path)
+{
+    const int x1 = (int)BOUND(floorf(path->x1), 0.0f, (float)fb->w);
+    const int x2 = (int)BOUND(ceilf(path->x2) + 1.0f, 0.0f, (float)fb->w);
+    const int y1 = (int)BOUND(floorf(path->y1), 0.0f, (float)fb->h);
+    const int y2 = (int)BOUND(ceilf(path->y2), 0.0f, (float)fb->h);
+    const int w = x2 - x1;
+    const int stride = w + 2;
+    if (w <= 0 || y2 <= y1)
+	return;
+
+    pseg_t* seg = (pseg_t *)malloc(path->npt * sizeof(pseg_t));
+    int* active = (int *)malloc(path->npt * sizeof(int));
+    float* acc = (float *)calloc(stride * PATH_BAND, sizeof(float));
+    uint8_t* cov = (uint8_t *)malloc(w);
+    if (!seg || !active || !acc || !cov) {
+	error(fb, "Error: insufficient memory for fb_path_fill() (%d)", path->npt);
+	goto done;
+    }
+
+    int nseg = 0;
+    for (int c = 0; c < path->nct; c++) {
+	const contour_t* ct = &path->ct[c];
+	for (int i = 0; ct->n > 1 && i < ct->n; i++) {
+	    const fpoint_t* p0 = &path->pt[ct->first + i];
+	    const fpoint_t* p1 = &path->pt[ct->first + (i + 1) % ct->n];
+	    if (p0->y == p1->y)
+		continue;
+	    pseg_t* s = &seg[nseg++];
+	    s->x0 = p0->x - x1;
+	    s->y0 = p0->y;
+	    s->x1 = p1->x - x1;
+	    s->y1 = p1->y;
+	    s->ymin = MIN(p0->y, p1->y);
+	    s->ymax = MAX(p0->y, p1->y);
+	}
+    }
+    qsort(seg, nseg, sizeof(pseg_t), pseg_cmp);
+
+    int na = 0;
+    int next = 0;
+    for (int top = y1; top < y2; top += PATH_BAND) {
+	const int rows = MIN(PATH_BAND, y2 - top);
+	const float ft = (float)top;
+	const float fbot = (float)(top + rows);
+
+	/* retire segments above the band, activate those reaching into it */
+	int j = 0;
+	for (int i = 0; i < na; i++) {
+	    if (seg[active[i]].ymax > ft)
+		active[j++] = active[i];
+	}
+	na = j;
+	while (next < nseg && seg[next].ymin < fbot) {
+	    if (seg[next].ymax > ft)
+		active[na++] = next;
+	    next++;
+	}
+	if (0 == na)
+	    continue;
+
+	for (int i = 0; i < na; i++) {
+	    const pseg_t* s = &seg[active[i]];
+	    const float dxdy = (s->x1 - s->x0) / (s->y1 - s->y0);
+	    const float ya = BOUND(s->y0, ft, fbot);
+	    const float yb = BOUND(s->y1, ft, fbot);
+	    acc_clip(acc, stride, (float)w,
+		s->x0 + (ya - s->y0) * dxdy, ya - ft,
+		s->x0 + (yb - s->y0) * dxdy, yb - ft);
+	}
+
+	for (int r = 0; r < rows; r++) {
+	    float* row = acc + r * stride;
+	    float sum = 0.0f;
+	    int any = 0;
+	    for (int i = 0; i < w; i++) {
+		sum += row[i];
+		row[i] = 0.0f;
+		const float a = fabsf(sum);
+		cov[i] = a >= 1.0f ? 255 : (uint8_t)(a * 255.0f + 0.5f);
+		any |= cov[i];
+	    }
+	    row[w] = row[w+1] = 0.0f;
+	    if (!any)
+		continue;
+	    if (rop_copy == fb->rop) {
+		fb->covspan(fb, x1, top + r, cov, w);
+		continue;
+	    }
+	    /* raster operations combine whole pixels, so threshold the coverage */
+	    for (int i = 0; i < w; ) {
+		if (cov[i] < 128) {
+		    i++;
+		    continue;
+		}
+		const int start = i;
+		while (i < w && cov[i] >= 128)
+		    i++;
+		fb->hline(fb, x1 + start, top + r, i - start);
+	    }
+	}
+    }
+
+done:
+    free(cov);
+    free(acc);
+    free(active);
+    free(seg);
+}
+
+/**
+ * @brief Fill a path with anti-aliased edges using the foreground color
+ *
+ * All contours are treated as closed and filled with the non-zero
+ * winding rule. The signed area of every segment is accumulated into
+ * a buffer of @ref PATH_BAND scan lines, the prefix sum of each row
+ * gives its coverage, which is then blended into the frame buffer.
+ * The memory used is proportional to the width of the path only.
+ * With a transform set the points are mapped through it first.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param path pointer to the path
+ */
+void fb_path_fill(sfb_t* fb, const sfb_path_t* path)
+{
+    CHECK_FB(fb);
+    if (!path || path->npt < 2)
+	return;
+    if (!fb->xform) {
+	path_fill(fb, path);
+	return;
+    }
+
+    sfb_path_t tp = *path;
+    tp.pt = (fpoint_t *)malloc(path->npt * sizeof(fpoint_t));
+    if (!tp.pt) {
+	error(fb, "Error: insufficient memory for fb_path_fill() (%d)", path->npt);
+	return;
+    }
+    const float* m = fb->xm;
+    for (int i = 0; i < path->npt; i++) {
+	const fpoint_t* p = &path->pt[i];
+	const float x = m[0] * p->x + m[1] * p->y + m[2];
+	const float y = m[3] * p->x + m[4] * p->y + m[5];
+	tp.pt[i].x = x;
+	tp.pt[i].y = y;
+	if (0 == i) {
+	    tp.x1 = tp.x2 = x;
+	    tp.y1 = tp.y2 = y;
+	} else {
+	    tp.x1 = MIN(tp.x1, x);
+	    tp.y1 = MIN(tp.y1, y);
+	    tp.x2 = MAX(tp.x2, x);
+	    tp.y2 = MAX(tp.y2, y);
+	}
+    }
+    path_fill(fb, &tp);
+    free(tp.pt);
+}
+
+/**
+ * @brief Add the polygon @p pt with @p n points as a contour to @p out
+ *
+ * All stroke pieces are added with the same orientation, so that
+ * filling with the non-zero rule yields their union.
+ */
+static void stroke_poly(sfb_path_t* out, const fpoint_t* pt, int n)
+{
+    float area = 0.0f;
+    for (int i = 0; i < n; i++) {
+	const fpoint_t* a = &pt[i];
+	const fpoint_t* b = &pt[(i + 1) % n];
+	area += a->x * b->y - b->x * a->y;
+    }
+    if (area > 0.0f) {
+	if (fb_path_moveto(out, pt[n-1].x, pt[n-1].y) < 0)
+	    return;
+	for (int i = n - 2; i >= 0; i--)
+	    fb_path_lineto(out, pt[i].x, pt[i].y);
+    } else {
+	if (fb_path_moveto(out, pt[0].x, pt[0].y) < 0)
+	    return;
+	for (int i = 1; i < n; i++)
+	    fb_path_lineto(out, pt[i].x, pt[i].y);
+    }
+    fb_path_close(out);
+}
+
+/**
+ * @brief Add a disc at @p p with radius @p r to @p out
+ */
+static void stroke_disc(sfb_path_t* out, fpoint_t p, float r)
+{
+    fpoint_t pt[128];
+    int n = 8;
+    if (r > PATH_TOLERANCE)
+	n = (int)ceilf((float)M_PI / acosf(1.0f - PATH_TOLERANCE / r));
+    n = BOUND(n, 8, 128);
+    for (int i = 0; i < n; i++) {
+	const float t = 2.0f * (float)M_PI * i / n;
+	pt[i].x = p.x + r * cosf(t);
+	pt[i].y = p.y + r * sinf(t);
+    }
+    stroke_poly(out, pt, n);
+}
+
+/**
+ * @brief Add a cap at the end point @p p of a line in direction @p d
+ */
+static void stroke_cap(sfb_t* fb, sfb_path_t* out, fpoint_t p, fpoint_t d, float hw)
+{
+    switch (fb->line_cap) {
+    case cap_round:
+	stroke_disc(out, p, hw);
+	break;
+    case cap_square:
+	{
+	    const fpoint_t pt[4] = {
+		{ p.x - d.y * hw, p.y + d.x * hw },
+		{ p.x - d.y * hw + d.x * hw, p.y + d.x * hw + d.y * hw },
+		{ p.x + d.y * hw + d.x * hw, p.y - d.x * hw + d.y * hw },
+		{ p.x + d.y * hw, p.y - d.x * hw }
+	    };
+	    stroke_poly(out, pt, 4);
+	}
+	break;
+    case cap_butt:
+    default:
+	break;
+    }
+}
+
+/**
+ * @brief Add a join at @p p between the directions @p di and @p dout
+ */
+static void stroke_join(sfb_t* fb, sfb_path_t* out, fpoint_t p, fpoint_t di, fpoint_t dout, float hw)
+{
+    const float cross = di.x * dout.y - di.y * dout.x;
+    const float dot = di.x * dout.x + di.y * dout.y;
+    if (fabsf(cross) < 1e-6f && dot > 0.0f)
+	return;
+
+    /* the outer side of the turn */
+    const float s = cross > 0.0f ? -hw : hw;
+    const fpoint_t ni = { -di.y, di.x };
+    const fpoint_t no = { -dout.y, dout.x };
+    const fpoint_t a = { p.x + s * ni.x, p.y + s * ni.y };
+    const fpoint_t b = { p.x + s * no.x, p.y + s * no.y };
+
+    switch (fb->line_join) {
+    case join_round:
+	stroke_disc(out, p, hw);
+	return;
+    case join_miter:
+	{
+	    const float k = 1.0f + ni.x * no.x + ni.y * no.y;
+	    if (k > 1e-6f && sqrtf(2.0f / k) <= fb->miter_limit) {
+		const fpoint_t pt[4] = {
+		    p, a, { p.x + s * (ni.x + no.x) / k, p.y + s * (ni.y + no.y) / k }, b
+		};
+		stroke_poly(out, pt, 4);
+		return;
+	    }
+	}
+	/* fall through - the miter limit is exceeded */
+    case join_bevel:
+    default:
+	{
+	    const fpoint_t pt[3] = { p, a, b };
+	    stroke_poly(out, pt, 3);
+	}
+	break;
+    }
+}
+
+/**
+ * @brief Return the unit direction from @p a to @p b
+ */
+static fpoint_t stroke_dir(fpoint_t a, fpoint_t b)
+{
+    const float len = hypotf(b.x - a.x, b.y - a.y);
+    const fpoint_t d = { (b.x - a.x) / len, (b.y - a.y) / len };
+    return d;
+}
+
+/**
+ * @brief Stroke a polyline of @p n distinct points into the outline @p out
+ * @param fb pointer to the frame buffer context
+ * @param out pointer to the outline path
+ * @param pt points
+ * @param n number of points
+ * @param closed non zero if the polyline is closed
+ */
+static void stroke_contour(sfb_t* fb, sfb_path_t* out, const fpoint_t* pt, int n, int closed)
+{
+    const float hw = 0.5f * fb->line_width;
+
+    if (n < 1)
+	return;
+    if (1 == n) {
+	/* a dot is drawn for round and square caps only */
+	const fpoint_t d = { 1.0f, 0.0f };
+	stroke_cap(fb, out, pt[0], d, hw);
+	return;
+    }
+    if (n < 3)
+	closed = 0;
+
+    const int segs = closed ? n : n - 1;
+    for (int i = 0; i < segs; i++) {
+	const fpoint_t a = pt[i];
+	const fpoint_t b = pt[(i + 1) % n];
+	const fpoint_t d = stroke_dir(a, b);
+	const fpoint_t q[4] = {
+	    { a.x - d.y * hw, a.y + d.x * hw },
+	    { b.x - d.y * hw, b.y + d.x * hw },
+	    { b.x + d.y * hw, b.y - d.x * hw },
+	    { a.x + d.y * hw, a.y - d.x * hw }
+	};
+	stroke_poly(out, q, 4);
+    }
+
+    for (int i = closed ? 0 : 1; i < (closed ? n : n - 1); i++) {
+	const fpoint_t p = pt[i];
+	stroke_join(fb, out, p,
+	    stroke_dir(pt[(i + n - 1) % n], p),
+	    stroke_dir(p, pt[(i + 1) % n]), hw);
+    }
+
+    if (!closed) {
+	const fpoint_t d0 = stroke_dir(pt[1], pt[0]);
+	const fpoint_t d1 = stroke_dir(pt[n-2], pt[n-1]);
+	stroke_cap(fb, out, pt[0], d0, hw);
+	stroke_cap(fb, out, pt[n-1], d1, hw);
+    }
+}
+
+/**
+ * @brief Append @p p to the dash piece @p pc unless it repeats the last point
+ */
+static void dash_push(fpoint_t* pc, int* npc, fpoint_t p)
+{
+    if (*npc > 0 && pc[*npc - 1].x == p.x && pc[*npc - 1].y == p.y)
+	return;
+    pc[(*npc)++] = p;
+}
+
+/**
+ * @brief Split a polyline into the dashes of the current pattern and stroke them
+ * @param fb pointer to the frame buffer context
+ * @param out pointer to the outline path
+ * @param pt points
+ * @param n number of points
+ * @param closed non zero if the polyline is closed
+ * @param pc scratch buffer for at least @p n + 2 points
+ */
+static void stroke_dashed(sfb_t* fb, sfb_path_t* out, const fpoint_t* pt, int n, int closed, fpoint_t* pc)
+{
+    float period = 0.0f;
+    for (int i = 0; i < fb->ndash; i++)
+	period += fb->dash[i];
+    if (n < 2 || period <= 0.0f) {
+	stroke_contour(fb, out, pt, n, closed);
+	return;
+    }
+
+    float phase = fmodf(fb->dash_offset, period);
+    if (phase < 0.0f)
+	phase += period;
+    int di = 0;
+    while (phase >= fb->dash[di]) {
+	phase -= fb->dash[di];
+	di = (di + 1) % fb->ndash;
+    }
+    float left = fb->dash[di] - phase;
+    int on = !(di & 1);
+    int npc = 0;
+
+    if (on)
+	dash_push(pc, &npc, pt[0]);
+    const int segs = closed ? n : n - 1;
+    for (int i = 0; i < segs; i++) {
+	const fpoint_t a = pt[i];
+	const fpoint_t b = pt[(i + 1) % n];
+	const float len = hypotf(b.x - a.x, b.y - a.y);
+	float pos = 0.0f;
+	while (len - pos > left) {
+	    pos += left;
+	    const fpoint_t p = {
+		a.x + (b.x - a.x) * pos / len,
+		a.y + (b.y - a.y) * pos / len
+	    };
+	    if (on) {
+		dash_push(pc, &npc, p);
+		stroke_contour(fb, out, pc, npc, 0);
+		npc = 0;
+	    } else {
+		dash_push(pc, &npc, p);
+	    }
+	    on = !on;
+	    di = (di + 1) % fb->ndash;
+	    left = fb->dash[di];
+	}
+	left -= len - pos;
+	if (on)
+	    dash_push(pc, &npc, b);
+    }
+    if (on && npc > 0)
+	stroke_contour(fb, out, pc, npc, 0);
+}
+
+/**
+ * @brief Stroke all contours of @p path with the current line attributes
+ *
+ * Every segment, join and cap becomes a small polygon of the same
+ * orientation in one outline path, which is then filled in a single
+ * anti-aliased pass with @ref fb_path_fill().
+ *
+ * @param fb pointer to the frame buffer context
+ * @param path pointer to the path
+ */
+void fb_path_stroke(sfb_t* fb, const sfb_path_t* path)
+{
+    CHECK_FB(fb);
+    if (!path || 0 == path->npt || fb->line_width <= 0.0f)
+	return;
+    if (!fb->stroke && fb_path_init(&fb->stroke) < 0) {
+	error(fb, "Error: insufficient memory for fb_path_stroke()");
+	return;
+    }
+
+    fpoint_t* pt = (fpoint_t *)malloc((path->npt + 2) * sizeof(fpoint_t));
+    fpoint_t* pc = (fpoint_t *)malloc((path->npt + 2) * sizeof(fpoint_t));
+    if (!pt || !pc) {
+	error(fb, "Error: insufficient memory for fb_path_stroke() (%d)", path->npt);
+	goto done;
+    }
+
+    fb_path_reset(fb->stroke);
+    for (int c = 0; c < path->nct; c++) {
+	const contour_t* ct = &path->ct[c];
+	int n = 0;
+	for (int i = 0; i < ct->n; i++)
+	    dash_push(pt, &n, path->pt[ct->first + i]);
+	if (ct->closed && n > 1 && pt[0].x == pt[n-1].x && pt[0].y == pt[n-1].y)
+	    n--;
+	if (fb->ndash)
+	    stroke_dashed(fb, fb->stroke, pt, n, ct->closed, pc);
+	else
+	    stroke_contour(fb, fb->stroke, pt, n, ct->closed);
+    }
+    fb_path_fill(fb, fb->stroke);
+
+done:
+    free(pc);
+    free(pt);
+}
+
+/**
+ * @brief Stroke a polyline through the pixel centers of @p points
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of vertices
+ * @param n number of vertices
+ * @param closed non zero to connect the last vertex to the first
+ */
+static void stroke_points(sfb_t* fb, const point_t* points, int n, int closed)
+{
+    sfb_path_t path;
+    fpoint_t pbuf[16];
+    contour_t ct = { 0, 0, closed };
+
+    memset(&path, 0, sizeof(path));
+    path.pt = n <= 16 ? pbuf : (fpoint_t *)malloc(n * sizeof(fpoint_t));
+    if (!path.pt) {
+	error(fb, "Error: insufficient memory for %d points", n);
+	return;
+    }
+    path.ct = &ct;
+    path.nct = 1;
+    for (int i = 0; i < n; i++) {
+	path.pt[i].x = points[i].x + 0.5f;
+	path.pt[i].y = points[i].y + 0.5f;
+    }
+    path.npt = ct.n = n;
+    fb_path_stroke(fb, &path);
+    if (path.pt != pbuf)
+	free(path.pt);
+}
+
+/**
+ * @brief Draw an open polyline through @p points with the current line attributes
+ *
+ * @param fb pointer to the frame buffer context
+ * @param points array of vertices
+ * @param n number of vertices
+ */
+void fb_polyline(sfb_t* fb, const point_t* points, int n)
+{
+    CHECK_FB(fb);
+    if (n < 1)
+	return;
+    if (1.0f == fb->line_width && 0 == fb->ndash) {
+	for (int i = 1; i < n; i++)
+	    fb_line(fb, points[i-1].x, points[i-1].y, points[i].x, points[i].y);
+	plot(fb, points[n-1].x, points[n-1].y);
+	return;
+    }
+    stroke_points(fb, points, n, 0);
+}
+
+/**
+ * @brief Draw a flattened Bézier curve with the current line style
+ *
+ * One pixel wide solid curves go through the polyline path with
+ * fb_line() point by point, everything else through the stroker.
+ */
+static void bezier_draw(sfb_t* fb, const point_t* cp, int degree)
+{
+    fpoint_t p[4];
+    fpoint_t buf[BEZIER_STACK];
+    fpoint_t* pt = buf;
+    bezier_t b;
+
+    for (int i = 0; i <= degree; i++) {
+	p[i].x = cp[i].x + 0.5f;
+	p[i].y = cp[i].y + 0.5f;
+    }
+    const int n = 1 + bezier_init(&b, p, degree);
+    if (BEZIER_MAX == n - 1)
+	error(fb, "Error: curve limited to %d segments, coarser than the tolerance", BEZIER_MAX);
+
+    if (1.0f == fb->line_width && 0 == fb->ndash) {
+	int x0 = cp[0].x, y0 = cp[0].y;
+	for (int i = 1; i < n; i++) {
+	    const fpoint_t q = bezier_next(&b);
+	    const int x1 = (int)floorf(q.x);
+	    const int y1 = (int)floorf(q.y);
+	    fb_line(fb, x0, y0, x1, y1);
+	    x0 = x1;
+	    y0 = y1;
+	}
+	plot(fb, x0, y0);
+	return;
+    }
+
+    if (n > BEZIER_STACK) {
+	pt = (fpoint_t *)malloc(n * sizeof(fpoint_t));
+	if (NULL == pt) {
+	    error(fb, "Error: insufficient memory for %d curve points", n);
+	    return;
+	}
+    }
+    pt[0] = p[0];
+    for (int i = 1; i < n; i++)
+	pt[i] = bezier_next(&b);
+
+    sfb_path_t path;
+    contour_t ct = { 0, n, 0 };
+    memset(&path, 0, sizeof(path));
+    path.pt = pt;
+    path.npt = n;
+    path.ct = &ct;
+    path.nct = 1;
+    fb_path_stroke(fb, &path);
+
+    if (pt != buf)
+	free(pt);
+}
+
+/**
+ * @brief Draw a quadratic Bézier curve
+ *
+ * The curve is flattened adaptively to a quarter pixel and drawn with
+ * the current line width, join, cap and dash pattern. A curve drawn
+ * repeatedly is cheaper to add to a path once with
+ * @ref fb_path_quadto(), which keeps the flattened points.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x0 start point x coordinate
+ * @param y0 start point y coordinate
+ * @param x1 control point x coordinate
+ * @param y1 control point y coordinate
+ * @param x2 end point x coordinate
+ * @param y2 end point y coordinate
+ */
+void fb_bezier2(sfb_t* fb, int x0, int y0, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    const point_t cp[3] = { { x0, y0 }, { x1, y1 }, { x2, y2 } };
+    bezier_draw(fb, cp, 2);
+}
+
+/**
+ * @brief Draw a cubic Bézier curve
+ *
+ * The curve is flattened adaptively to a quarter pixel and drawn with
+ * the current line width, join, cap and dash pattern. A curve drawn
+ * repeatedly is cheaper to add to a path once with
+ * @ref fb_path_cubicto(), which keeps the flattened points.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x0 start point x coordinate
+ * @param y0 start point y coordinate
+ * @param x1 first control point x coordinate
+ * @param y1 first control point y coordinate
+ * @param x2 second control point x coordinate
+ * @param y2 second control point y coordinate
+ * @param x3 end point x coordinate
+ * @param y3 end point y coordinate
+ */
+void fb_bezier3(sfb_t* fb, int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3)
+{
+    CHECK_FB(fb);
+    const point_t cp[4] = { { x0, y0 }, { x1, y1 }, { x2, y2 }, { x3, y3 } };
+    bezier_draw(fb, cp, 3);
+}
+
+/**
+ * @brief Set the line width for strokes
+ *
+ * A width other than 1, or a dash pattern, makes @ref fb_line(),
+ * @ref fb_rect() and @ref fb_polyline() use the stroker.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param width line width in pixels
+ */
+void fb_set_line_width(sfb_t* fb, float width)
+{
+    CHECK_FB(fb);
+    fb->line_width = MAX(width, 0.0f);
+}
+
+/**
+ * @brief Set the join style for strokes
+ * @param fb pointer to the frame buffer context
+ * @param join join style
+ */
+void fb_set_line_join(sfb_t* fb, line_join_e join)
+{
+    CHECK_FB(fb);
+    fb->line_join = join;
+}
+
+/**
+ * @brief Set the cap style for strokes
+ * @param fb pointer to the frame buffer context
+ * @param cap cap style
+ */
+void fb_set_line_cap(sfb_t* fb, line_cap_e cap)
+{
+    CHECK_FB(fb);
+    fb->line_cap = cap;
+}
+
+/**
+ * @brief Set the miter limit for strokes
+ *
+ * Miter joins longer than @p limit times the line width become bevels.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param limit miter limit (>= 1)
+ */
+void fb_set_miter_limit(sfb_t* fb, float limit)
+{
+    CHECK_FB(fb);
+    fb->miter_limit = MAX(limit, 1.0f);
+}
+
+/**
+ * @brief Set the dash pattern for strokes
+ *
+ * The pattern alternates between "on" and "off" lengths in pixels.
+ * An odd number of entries is repeated to make it even. Negative
+ * lengths count as 0, other lengths below 1/16 pixel are rounded up
+ * to 1/16. A pattern with too many entries is rejected and lines
+ * stay solid.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param dash array of lengths, or NULL for solid lines
+ * @param n number of lengths (at most 4 for odd, 8 for even counts)
+ * @param offset distance into the pattern at the start of a line
+ */
+void fb_set_dash(sfb_t* fb, const float* dash, int n, float offset)
+{
+    CHECK_FB(fb);
+    fb->ndash = 0;
+    fb->dash_offset = offset;
+    if (!dash || n <= 0)
+	return;
+    if ((n & 1) ? 2 * n > MAX_DASH : n > MAX_DASH) {
+	error(fb, "Error: dash pattern of %d entries, at most %d odd or %d even",
+	    n, MAX_DASH / 2, MAX_DASH);
+	return;
+    }
+    for (int i = 0; i < n; i++)
+	fb->dash[i] = dash[i] > 0.0f ? MAX(dash[i], DASH_MIN) : 0.0f;
+    fb->ndash = n;
+    if (n & 1) {
+	memcpy(&fb->dash[n], fb->dash, n * sizeof(float));
+	fb->ndash = 2 * n;
+    }
+}
+
+/**
+ * @brief Enable or disable ordered dithering for gradients
+ *
+ * Dithering only has an effect on frame buffers with 16 bits per
+ * pixel, where it hides the banding of the 5 and 6 bit channels.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param dither non-zero to enable dithering
+ */
+void fb_set_dither(sfb_t* fb, int dither)
+{
+    CHECK_FB(fb);
+    fb->dither = dither ? 1 : 0;
+}
+
+/**
+ * @brief Release the brush tile and go back to solid fills
+ */
+static void brush_free(sfb_t* fb)
+{
+    free(fb->brush);
+    fb->brush = NULL;
+    fb->fillspan = fb->hline;
+}
+
+/**
+ * @brief Allocate a brush tile for a pattern of @p pw x @p ph pixels
+ *
+ * The tile width is rounded up to a multiple of @p pw of at least
+ * 64 pixels, so that spans can be copied in long runs.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int brush_alloc(sfb_t* fb, int pw, int ph)
+{
+    int bw = pw;
+    while (bw < 64)
+	bw += pw;
+    const int bpx = 1 == fb->bpp ? 1 : fb->bpp / 8;
+    uint8_t* tile = (uint8_t *)malloc((size_t)(bw * bpx) * ph);
+    if (!tile) {
+	error(fb, "Error: insufficient memory for a %dx%d brush", pw, ph);
+	return -1;
+    }
+    brush_free(fb);
+    fb->brush = tile;
+    fb->brush_w = bw;
+    fb->brush_h = ph;
+    fb->brush_stride = (size_t)(bw * bpx);
+    fb->brush_pw = pw;
+    fb->fillspan = brushspan_copy;
+    return 0;
+}
+
+/**
+ * @brief Store the pixel @p pix at column @p i of the brush tile row @p j
+ */
+static void brush_store(sfb_t* fb, int i, int j, color_t pix)
+{
+    uint8_t* dst = fb->brush + j * fb->brush_stride;
+    switch (fb->bpp) {
+    case 1:
+	dst[i] = pix ? 1 : 0;
+	break;
+    case 8:
+	dst[i] = (uint8_t)pix;
+	break;
+    case 16:
+	dst[2*i+0] = (uint8_t)(pix >> 0);
+	dst[2*i+1] = (uint8_t)(pix >> 8);
+	break;
+    case 24:
+	dst[3*i+0] = (uint8_t)(pix >>  0);
+	dst[3*i+1] = (uint8_t)(pix >>  8);
+	dst[3*i+2] = (uint8_t)(pix >> 16);
+	break;
+    case 32:
+	dst[4*i+0] = (uint8_t)(pix >>  0);
+	dst[4*i+1] = (uint8_t)(pix >>  8);
+	dst[4*i+2] = (uint8_t)(pix >> 16);
+	dst[4*i+3] = (uint8_t)(pix >> 24);
+	break;
+    }
+}
+
+/**
+ * @brief Repeat the first pattern width of every tile row to the full tile width
+ */
+static void brush_replicate(sfb_t* fb)
+{
+    const size_t n = fb->brush_stride / fb->brush_w * fb->brush_pw;
+    for (int j = 0; j < fb->brush_h; j++) {
+	uint8_t* row = fb->brush + j * fb->brush_stride;
+	for (size_t o = n; o < fb->brush_stride; o += n)
+	    memcpy(row + o, row, n);
+    }
+}
+
+/**
+ * @brief Convert the stipple bits to a tile with the current colors
+ */
+static void brush_stipple_build(sfb_t* fb)
+{
+    for (int j = 0; j < 8; j++)
+	for (int i = 0; i < 8; i++)
+	    brush_store(fb, i, j, (fb->stipple[j] & (0x80 >> i)) ? fb->fgcolor : fb->bgcolor);
+    brush_replicate(fb);
+    fb->brush_fg = fb->fgcolor;
+    fb->brush_bg = fb->bgcolor;
+}
+
+/**
+ * @brief Fill with the foreground color (no brush)
+ *
+ * @param fb pointer to the frame buffer context
+ */
+void fb_set_brush_solid(sfb_t* fb)
+{
+    CHECK_FB(fb);
+    brush_free(fb);
+}
+
+/**
+ * @brief Fill with an 8x8 stipple pattern
+ *
+ * Set bits are drawn in the foreground color. Clear bits are drawn in
+ * the background color in opaque mode and left alone otherwise. The
+ * most significant bit is the leftmost pixel.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param bits eight rows of the pattern
+ */
+void fb_set_brush_stipple(sfb_t* fb, const unsigned char bits[8])
+{
+    CHECK_FB(fb);
+    if (!bits || brush_alloc(fb, 8, 8) < 0)
+	return;
+    memcpy(fb->stipple, bits, sizeof(fb->stipple));
+    brush_stipple_build(fb);
+    fb->fillspan = brushspan_stipple;
+}
+
+/**
+ * @brief Fill with a tiled pixmap
+ *
+ * The pixmap is converted to the frame buffer format once. Its alpha
+ * channel is ignored.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param src pointer to the ARGB 8-8-8-8 pixels
+ * @param w width of the pixmap in pixels
+ * @param h height of the pixmap in pixels
+ * @param stride distance between rows of @p src in pixels
+ */
+void fb_set_brush_pixmap(sfb_t* fb, const argb_t* src, int w, int h, int stride)
+{
+    CHECK_FB(fb);
+    if (!src || w <= 0 || h <= 0 || brush_alloc(fb, w, h) < 0)
+	return;
+    for (int j = 0; j < h; j++) {
+	const argb_t* s = src + (size_t)j * stride;
+	for (int i = 0; i < w; i++)
+	    brush_store(fb, i, j, fb->rgb2pix((s[i] >> 16) & 0xff, (s[i] >> 8) & 0xff, s[i] & 0xff));
+    }
+    brush_replicate(fb);
+}
+
+/**
+ * @brief Fill with a tile copied from the frame buffer at @p x, @p y
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x left x coordinate of the tile
+ * @param y top y coordinate of the tile
+ * @param w width of the tile in pixels
+ * @param h height of the tile in pixels
+ */
+void fb_set_brush_tile(sfb_t* fb, int x, int y, int w, int h)
+{
+    CHECK_FB(fb);
+    if (w <= 0 || h <= 0 || brush_alloc(fb, w, h) < 0)
+	return;
+    for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	    brush_store(fb, i, j, fb->getpixel(fb, x + i, y + j));
+    brush_replicate(fb);
+}
+
+/**
+ * @brief Set the origin of the brush pattern
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x x coordinate of the pattern's top left pixel
+ * @param y y coordinate of the pattern's top left pixel
+ */
+void fb_set_brush_origin(sfb_t* fb, int x, int y)
+{
+    CHECK_FB(fb);
+    fb->brush_x = x;
+    fb->brush_y = y;
+}
+
+/**
+ * @brief Set the raster operation for drawing
+ *
+ * The setpixel, hline and vline kernels are replaced with kernels for
+ * the raster operation, so lines, rectangles, fills and glyphs all
+ * combine the foreground color with the frame buffer. With rop_xor
+ * drawing the same thing twice restores the original contents.
+ * rop_copy restores the plain kernels. Thick and dashed lines and
+ * filled paths honour the raster operation too, but without
+ * anti-aliasing: pixels at least half covered are drawn. Anti-aliased
+ * primitives, blending, gradients, triangles, brushes and flood fills
+ * always copy.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param rop raster operation
+ */
+void fb_set_rop(sfb_t* fb, rop_e rop)
+{
+    CHECK_FB(fb);
+    const int solid = fb->fillspan == fb->hline;
+
+    switch (rop) {
+    case rop_xor:
+	fb->setpixel = setpixel_xor;
+	fb->hline = hline_xor;
+	fb->vline = vline_xor;
+	break;
+    case rop_and:
+	fb->setpixel = setpixel_and;
+	fb->hline = hline_and;
+	fb->vline = vline_and;
+	break;
+    case rop_or:
+	fb->setpixel = setpixel_or;
+	fb->hline = hline_or;
+	fb->vline = vline_or;
+	break;
+    case rop_invert:
+	fb->setpixel = setpixel_invert;
+	fb->hline = hline_invert;
+	fb->vline = vline_invert;
+	break;
+    default:
+	rop = rop_copy;
+	fb->setpixel = fb->setpixel_copy;
+	fb->hline = fb->hline_copy;
+	fb->vline = fb->vline_copy;
+	break;
+    }
+    if (solid)
+	fb->fillspan = fb->hline;
+    fb->rop = rop;
+}
+
+/**
+ * @brief Set the coordinate transform
+ *
+ * Points, vertices of lines, rectangles, polygons, curves and paths,
+ * the centers of circles, ellipses and radial gradients and the end
+ * points of linear gradients are mapped from x, y to
+ * x' = a x + b y + c, y' = d x + e y + f before drawing. The mapping
+ * happens once per vertex in 16.16 fixed point. Radii are scaled, but
+ * circles, ellipses and radial gradients stay axis aligned. Rectangles
+ * under a scale and translate transform are still drawn with the span
+ * kernels, under rotation or shear they become polygons; blended and
+ * gradient filled rectangles are clipped row by row to the mapped
+ * quadrilateral. Line widths and dashes are in transformed units.
+ * Pixel operations, text, bitmaps and images use device coordinates.
+ * With the identity transform all of this is skipped.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param a x scale
+ * @param b x shear
+ * @param c x translation
+ * @param d y shear
+ * @param e y scale
+ * @param f y translation
+ */
+void fb_set_transform(sfb_t* fb, float a, float b, float c, float d, float e, float f)
+{
+    CHECK_FB(fb);
+    fb->xm[0] = a;
+    fb->xm[1] = b;
+    fb->xm[2] = c;
+    fb->xm[3] = d;
+    fb->xm[4] = e;
+    fb->xm[5] = f;
+    xform_update(fb);
+}
+
+/**
+ * @brief Reset the coordinate transform to the identity
+ *
+ * @param fb pointer to the frame buffer context
+ */
+void fb_reset_transform(sfb_t* fb)
+{
+    fb_set_transform(fb, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+}
+
+/**
+ * @brief Translate the coordinate system by @p tx, @p ty
+ *
+ * Like @ref fb_scale() and @ref fb_rotate() this applies before the
+ * current transform.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param tx x translation
+ * @param ty y translation
+ */
+void fb_translate(sfb_t* fb, float tx, float ty)
+{
+    CHECK_FB(fb);
+    float* m = fb->xm;
+    m[2] += m[0] * tx + m[1] * ty;
+    m[5] += m[3] * tx + m[4] * ty;
+    xform_update(fb);
+}
+
+/**
+ * @brief Scale the coordinate system by @p sx, @p sy
+ *
+ * @param fb pointer to the frame buffer context
+ * @param sx x scale factor
+ * @param sy y scale factor
+ */
+void fb_scale(sfb_t* fb, float sx, float sy)
+{
+    CHECK_FB(fb);
+    float* m = fb->xm;
+    m[0] *= sx;
+    m[3] *= sx;
+    m[1] *= sy;
+    m[4] *= sy;
+    xform_update(fb);
+}
+
+/**
+ * @brief Rotate the coordinate system by @p angle degrees (clockwise on screen)
+ *
+ * @param fb pointer to the frame buffer context
+ * @param angle rotation in degrees
+ */
+void fb_rotate(sfb_t* fb, float angle)
+{
+    CHECK_FB(fb);
+    const float rad = angle * (float)M_PI / 180.0f;
+    const float c = cosf(rad);
+    const float s = sinf(rad);
+    float* m = fb->xm;
+    const float a = m[0], b = m[1], d = m[3], e = m[4];
+    m[0] = a * c + b * s;
+    m[1] = b * c - a * s;
+    m[3] = d * c + e * s;
+    m[4] = e * c - d * s;
+    xform_update(fb);
+}
+
+/**
+ * @brief Return the line width for strokes
+ * @param fb pointer to the frame buffer context
+ * @return line width in pixels
+ */
+float fb_line_width(sfb_t* fb)
+{
+    CHECK_FB_RET(fb, 0.0f);
+    return fb->line_width;
+}
+
+/**
+ * @brief Return the current raster operation
+ * @param fb pointer to the frame buffer context
+ * @return raster operation
+ */
+rop_e fb_rop(sfb_t* fb)
+{
+    CHECK_FB_RET(fb, rop_copy);
+    return fb->rop;
+}
+
+static int wide_cmp(const void* a, const void* b)
+{
+    const fbwide_t* wa = (const fbwide_t *)a;
+    const fbwide_t* wb = (const fbwide_t *)b;
+    return wa->wc < wb->wc ? -1 : wa->wc > wb->wc ? 1 : 0;
+}
+
+/**
+ * @brief Build the glyph lookup index of @p font, unless it exists
+ *
+ * Only the first glyph of a code point that appears more than once is
+ * indexed, which is the one the linear search of the map finds.
+ */
+static void font_index_build(const fbfont_t* font)
+{
+    fbindex_t* idx = font->index;
+    if (idx->valid)
+	return;
+
+    int nwide = 0;
+    for (int i = 0; font->map[i]; i++)
+	if ((uint32_t)font->map[i] > 0xff)
+	    nwide++;
+    if (nwide && !idx->wide) {
+	idx->wide = (fbwide_t *)malloc(nwide * sizeof(fbwide_t));
+	if (!idx->wide)
+	    return;
+    }
+
+    uint8_t seen[256];
+    memset(seen, 0, sizeof(seen));
+    memset(idx->latin1, 0, sizeof(idx->latin1));
+    idx->nwide = 0;
+    for (int i = 0; font->map[i]; i++) {
+	const wchar_t wc = font->map[i];
+	if ((uint32_t)wc <= 0xff) {
+	    if (!seen[wc]) {
+		seen[wc] = 1;
+		idx->latin1[wc] = (unsigned short)i;
+	    }
+	} else {
+	    idx->wide[idx->nwide].wc = wc;
+	    idx->wide[idx->nwide].glyph = (unsigned short)i;
+	    idx->nwide++;
+	}
+    }
+    if (idx->nwide) {
+	qsort(idx->wide, idx->nwide, sizeof(fbwide_t), wide_cmp);
+	/* keep the lowest glyph number for duplicates */
+	int n = 1;
+	for (int i = 1; i < idx->nwide; i++) {
+	    if (idx->wide[i].wc == idx->wide[n-1].wc) {
+		idx->wide[n-1].glyph = MIN(idx->wide[n-1].glyph, idx->wide[i].glyph);
+		continue;
+	    }
+	    idx->wide[n++] = idx->wide[i];
+	}
+	idx->nwide = n;
+    }
+    idx->valid = 1;
+}
+
+#if defined(SFB_THREADS)
+/**
+ * @brief Serializes building the glyph lookup indexes shared by all contexts
+ */
+static pthread_mutex_t font_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/**
+ * @brief Make sure the glyph lookup index of @p font is built
+ *
+ * The index is shared by all contexts using the font. It is built once
+ * under @ref font_lock and not changed afterwards. Every context calls
+ * this before it looks up glyphs, so taking the lock also makes the
+ * finished index visible to its thread.
+ */
+static void font_index(const fbfont_t* font)
+{
+    if (!font->index)
+	return;
+#if defined(SFB_THREADS)
+    pthread_mutex_lock(&font_lock);
+#endif
+    font_index_build(font);
+#if defined(SFB_THREADS)
+    pthread_mutex_unlock(&font_lock);
+#endif
+}
+
+/**
+ * @brief Return the glyph number of @p wc in @p font, or 0 if it has none
+ */
+static uint32_t font_glyph(const fbfont_t* font, wchar_t wc)
+{
+    const fbindex_t* idx = font->index;
+    if (!idx || !idx->valid) {
+	for (uint32_t i = 0; font->map[i]; i++)
+	    if (wc == font->map[i])
+		return i;
+	return 0;
+    }
+    if ((uint32_t)wc <= 0xff)
+	return idx->latin1[wc];
+
+    int lo = 0, hi = idx->nwide - 1;
+    while (lo <= hi) {
+	const int mid = (lo + hi) / 2;
+	if (idx->wide[mid].wc == wc)
+	    return idx->wide[mid].glyph;
+	if (idx->wide[mid].wc < wc)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert the rows of glyph @p glyph of @p font to most significant bit first bytes
+ * @return number of rows (at most 64), each (font->w + 7) / 8 bytes in @p rows
+ */
+static int glyph_rows(const fbfont_t* font, uint32_t glyph, uint8_t* rows)
+{
+    const off_t offs = font->h * glyph;
+    const int h = MIN(font->h, 64);
+    const int stride = (font->w + 7) / 8;
+
+    if (font->w <= 8) {
+	/* One uint8_t per glyph row */
+	const uint8_t* data = (const uint8_t *)font->data;
+	for (int y0 = 0; y0 < h; y0++)
+	    rows[y0] = (uint8_t)(data[offs+y0] << (8 - font->w));
+    } else if (font->w <= 16) {
+	/* One uint16_t per glyph row */
+	const uint16_t* data = (const uint16_t *)font->data;
+	for (int y0 = 0; y0 < h; y0++) {
+	    const uint16_t bits = (uint16_t)(data[offs+y0] << (16 - font->w));
+	    rows[y0*stride+0] = (uint8_t)(bits >> 8);
+	    if (stride > 1)
+		rows[y0*stride+1] = (uint8_t)(bits >> 0);
+	}
+    } else {
+	/* One uint32_t per glyph row */
+	const uint32_t* data = (const uint32_t *)font->data;
+	for (int y0 = 0; y0 < h; y0++) {
+	    const uint32_t bits = data[offs+y0] << (32 - font->w);
+	    for (int b = 0; b < stride; b++)
+		rows[y0*stride+b] = (uint8_t)(bits >> (24 - 8 * b));
+	}
+    }
+    return h;
+}
+
+/**
+ * @brief A glyph cell in frame buffer format
+ *
+ * Opaque glyphs are @p h rows of @p w pixels. Transparent glyphs are
+ * one row of @p w foreground pixels followed by the runs of each row:
+ * a count n and n pairs of start and length of the set pixels.
+ */
+typedef struct glyph_s {
+    struct glyph_s* next;	/*!< next glyph in the same hash bucket */
+    struct glyph_s* newer;	/*!< more recently used glyph */
+    struct glyph_s* older;	/*!< less recently used glyph */
+    const fbfont_t* font;	/*!< font of the glyph */
+    uint32_t glyph;		/*!< glyph number in the font */
+    color_t fg;			/*!< foreground color */
+    color_t bg;			/*!< background color (opaque glyphs only) */
+    int bpp;			/*!< frame buffer depth */
+    int opaque;			/*!< non-zero for an opaque glyph cell */
+    int w;			/*!< width in pixels */
+    int h;			/*!< height in pixels */
+    size_t size;		/*!< bytes allocated for data */
+    uint8_t* data;		/*!< pixels or runs */
+}   glyph_t;
+
+/**
+ * @brief Hash bucket of a glyph cache key
+ */
+static inline uint32_t glyph_hash(const fbfont_t* font, uint32_t glyph, color_t fg, color_t bg, int opaque)
+{
+    uint32_t h = (uint32_t)((uintptr_t)font >> 4) * 2654435761u;
+    h ^= glyph * 40503u;
+    h ^= fg * 2246822519u;
+    if (opaque)
+	h ^= bg * 3266489917u + 1u;
+    return (h ^ (h >> 15)) & (GLYPH_HASH - 1);
+}
+
+/**
+ * @brief Unlink @p g from the LRU list
+ */
+static void glyph_unlink(sfb_t* fb, glyph_t* g)
+{
+    if (g->newer)
+	g->newer->older = g->older;
+    else
+	fb->gc_newest = g->older;
+    if (g->older)
+	g->older->newer = g->newer;
+    else
+	fb->gc_oldest = g->newer;
+    g->newer = g->older = NULL;
+}
+
+/**
+ * @brief Make @p g the most recently used glyph
+ */
+static void glyph_touch(sfb_t* fb, glyph_t* g)
+{
+    if (fb->gc_newest == g)
+	return;
+    if (g->newer || g->older || fb->gc_oldest == g)
+	glyph_unlink(fb, g);
+    g->older = fb->gc_newest;
+    if (fb->gc_newest)
+	fb->gc_newest->newer = g;
+    fb->gc_newest = g;
+    if (!fb->gc_oldest)
+	fb->gc_oldest = g;
+}
+
+/**
+ * @brief Free all cached glyphs
+ */
+static void glyph_cache_free(sfb_t* fb)
+{
+    glyph_t* g = fb->gc_newest;
+    while (g) {
+	glyph_t* older = g->older;
+	free(g->data);
+	free(g);
+	g = older;
+    }
+    memset(fb->gc_hash, 0, sizeof(fb->gc_hash));
+    fb->gc_newest = fb->gc_oldest = NULL;
+    fb->gc_count = 0;
+}
+
+/**
+ * @brief Render glyph @p glyph of @p font into @p g for the current colors and mode
+ * @return 0 on success, -1 if out of memory
+ */
+static int glyph_render(sfb_t* fb, glyph_t* g, const fbfont_t* font, uint32_t glyph)
+{
+    uint8_t rows[64 * 4];
+    const int bpx = fb->bpp / 8;
+    const int w = font->w;
+    const int h = glyph_rows(font, glyph, rows);
+    const int stride = (w + 7) / 8;
+    size_t size;
+
+    if (fb->opaque) {
+	size = (size_t)w * h * bpx;
+    } else {
+	/* worst case: a run for every other pixel */
+	size = (size_t)w * bpx + (size_t)h * (1 + (w + 1) / 2 * 2);
+    }
+    if (size > g->size) {
+	uint8_t* data = (uint8_t *)realloc(g->data, size);
+	if (!data)
+	    return -1;
+	g->data = data;
+	g->size = size;
+    }
+
+    uint8_t* dst = g->data;
+    if (fb->opaque) {
+	for (int j = 0; j < h; j++) {
+	    for (int i = 0; i < w; i++, dst += bpx) {
+		const color_t c = rows[j * stride + i / 8] & (0x80 >> (i & 7)) ? fb->fgcolor : fb->bgcolor;
+		for (int b = 0; b < bpx; b++)
+		    dst[b] = (uint8_t)(c >> (8 * b));
+	    }
+	}
+    } else {
+	for (int i = 0; i < w; i++, dst += bpx)
+	    for (int b = 0; b < bpx; b++)
+		dst[b] = (uint8_t)(fb->fgcolor >> (8 * b));
+	for (int j = 0; j < h; j++) {
+	    const uint8_t* row = rows + j * stride;
+	    uint8_t* count = dst++;
+	    *count = 0;
+	    for (int i = 0; i < w; ) {
+		if (!(row[i / 8] & (0x80 >> (i & 7)))) {
+		    i++;
+		    continue;
+		}
+		const int start = i;
+		while (i < w && (row[i / 8] & (0x80 >> (i & 7))))
+		    i++;
+		*dst++ = (uint8_t)start;
+		*dst++ = (uint8_t)(i - start);
+		(*count)++;
+	    }
+	}
+    }
+
+    g->font = font;
+    g->glyph = glyph;
+    g->fg = fb->fgcolor;
+    g->bg = fb->opaque ? fb->bgcolor : 0;
+    g->bpp = fb->bpp;
+    g->opaque = fb->opaque ? 1 : 0;
+    g->w = w;
+    g->h = h;
+    return 0;
+}
+
+/**
+ * @brief Return the cached glyph @p glyph of @p font for the current colors and mode
+ *
+ * A missing glyph is rendered, reusing the least recently used entry
+ * once the cache holds @ref GLYPH_CACHE glyphs.
+ *
+ * @return pointer to the glyph, or NULL if out of memory
+ */
+static glyph_t* glyph_get(sfb_t* fb, const fbfont_t* font, uint32_t glyph)
+{
+    const int opaque = fb->opaque ? 1 : 0;
+    const color_t bg = opaque ? fb->bgcolor : 0;
+    const uint32_t hash = glyph_hash(font, glyph, fb->fgcolor, bg, opaque);
+    glyph_t* g;
+
+    for (g = fb->gc_hash[hash]; g; g = g->next) {
+	if (g->font == font && g->glyph == glyph && g->fg == fb->fgcolor &&
+	    g->bg == bg && g->opaque == opaque && g->bpp == fb->bpp) {
+	    glyph_touch(fb, g);
+	    return g;
+	}
+    }
+
+    if (fb->gc_count < GLYPH_CACHE) {
+	g = (glyph_t *)calloc(1, sizeof(glyph_t));
+	if (!g)
+	    return NULL;
+	fb->gc_count++;
+    } else {
+	/* evict the least recently used glyph */
+	g = fb->gc_oldest;
+	glyph_unlink(fb, g);
+	const uint32_t old = glyph_hash(g->font, g->glyph, g->fg, g->bg, g->opaque);
+	glyph_t** pg = &fb->gc_hash[old];
+	while (*pg != g)
+	    pg = &(*pg)->next;
+	*pg = g->next;
+    }
+
+    if (glyph_render(fb, g, font, glyph) < 0) {
+	free(g->data);
+	free(g);
+	fb->gc_count--;
+	return NULL;
+    }
+    g->next = fb->gc_hash[hash];
+    fb->gc_hash[hash] = g;
+    glyph_touch(fb, g);
+    return g;
+}
+
+/**
+ * @brief Draw @p n glyphs of the current font side by side without the cache
+ *
+ * Only rows @p top to @p bottom are drawn.
+ */
+static void text_bitmap(sfb_t* fb, int x, int y, const uint32_t* glyph, int n, int top, int bottom)
+{
+    const fbfont_t* font = fb->font;
+    const int stride = (font->w + 7) / 8;
+    uint8_t rows[64 * 4];
+    for (int i = 0; i < n; i++, x += font->w) {
+	const int h = glyph_rows(font, glyph[i], rows);
+	const int j0 = MAX(0, top - y);
+	const int j1 = MIN(h, bottom + 1 - y);
+	if (j0 < j1)
+	    bitmap_blit(fb, x, y + j0, font->w, j1 - j0, rows + j0 * stride, stride);
+    }
+}
+
+/**
+ * @brief Draw up to @ref TEXT_GLYPHS cached glyphs one scanline at a time
+ *
+ * Opaque scanlines are composed across all glyphs in a staging buffer
+ * and written with one store. Transparent scanlines copy the runs of
+ * all glyphs from left to right, so the frame buffer is written in
+ * address order in both modes.
+ */
+static void text_chunk(sfb_t* fb, int x, int y, const uint32_t* glyph, int n, int top, int bottom,
+	uint8_t* stage)
+{
+    const glyph_t* g[TEXT_GLYPHS];
+    const uint8_t* run[TEXT_GLYPHS];
+
+    for (int i = 0; i < n; i++) {
+	g[i] = glyph_get(fb, fb->font, glyph[i]);
+	if (!g[i]) {
+	    text_bitmap(fb, x, y, glyph, n, top, bottom);
+	    return;
+	}
+    }
+
+    const int bpx = fb->bpp / 8;
+    const int w = g[0]->w;
+    const int x0 = MAX(0, -x);
+    const int x1 = MIN(n * w, fb->w - x);
+    const int y0 = MAX(0, top - y);
+    const int y1 = MIN(g[0]->h, bottom + 1 - y);
+    if (x0 >= x1 || y0 >= y1)
+	return;
+
+    /* range of glyphs that are at least partially visible */
+    const int i0 = x0 / w;
+    const int i1 = (x1 + w - 1) / w;
+    uint8_t* dst = &fb->fbp[(x + x0 + fb->x) * bpx + (y + y0 + fb->y) * fb->stride];
+
+    if (g[0]->opaque) {
+	const size_t row = (size_t)w * bpx;
+	const size_t len = (size_t)(x1 - x0) * bpx;
+	for (int j = y0; j < y1; j++, dst += fb->stride) {
+	    if (i1 - i0 == 1) {
+		memcpy(dst, g[i0]->data + j * row + (x0 - i0 * w) * bpx, len);
+		continue;
+	    }
+	    for (int i = i0; i < i1; i++)
+		memcpy(stage + (i - i0) * row, g[i]->data + j * row, row);
+	    memcpy(dst, stage + (x0 - i0 * w) * bpx, len);
+	}
+	return;
+    }
+
+    for (int i = i0; i < i1; i++)
+	run[i] = g[i]->data + (size_t)w * bpx;
+    dst -= x0 * bpx;
+    for (int j = 0; j < y1; j++) {
+	for (int i = i0; i < i1; i++) {
+	    const uint8_t* r = run[i];
+	    const int nr = *r++;
+	    run[i] = r + 2 * nr;
+	    if (j < y0)
+		continue;
+	    const uint8_t* fg = g[i]->data;
+	    for (int k = 0; k < nr; k++) {
+		const int s = MAX(i * w + r[2*k], x0);
+		const int e = MIN(i * w + r[2*k] + r[2*k+1], x1);
+		if (s < e)
+		    memcpy(dst + s * bpx, fg, (size_t)(e - s) * bpx);
+	    }
+	}
+	if (j >= y0)
+	    dst += fb->stride;
+    }
+}
+
+/**
+ * @brief Draw @p n glyphs of the current font on one text line at @p x, @p y
+ *
+ * The line is drawn in chunks of up to @ref TEXT_GLYPHS glyphs, each
+ * one scanline after the other. The staging buffer of the context is
+ * sized to hold the glyphs visible across the frame buffer, so a line
+ * of the width of the frame buffer is written with one store per
+ * scanline. 1bpp frame buffers and raster operations other than copy
+ * draw glyph by glyph. Only the frame buffer rows @p top to @p bottom
+ * are written.
+ */
+static void text_run(sfb_t* fb, int x, int y, const uint32_t* glyph, int n, int top, int bottom)
+{
+    const fbfont_t* font = fb->font;
+    uint8_t buf[TEXT_STAGE];
+    if (top > bottom)
+	return;
+    if (1 == fb->bpp || rop_copy != fb->rop) {
+	text_bitmap(fb, x, y, glyph, n, top, bottom);
+	return;
+    }
+
+    /* a chunk stages its visible glyphs, at most one partial at each end */
+    const size_t row = (size_t)font->w * (fb->bpp / 8);
+    const size_t need = (size_t)MIN(TEXT_GLYPHS, fb->w / font->w + 2) * row;
+    if (fb->text_stage_size < need) {
+	uint8_t* stage = (uint8_t *)realloc(fb->text_stage, need);
+	if (stage) {
+	    fb->text_stage = stage;
+	    fb->text_stage_size = need;
+	}
+    }
+    uint8_t* stage = buf;
+    int max = MIN(TEXT_GLYPHS, (int)(sizeof(buf) / row));
+    if (fb->text_stage_size >= need) {
+	stage = fb->text_stage;
+	max = TEXT_GLYPHS;
+    }
+
+    while (n > 0) {
+	const int k = MIN(n, max);
+	text_chunk(fb, x, y, glyph, k, top, bottom, stage);
+	x += k * font->w;
+	glyph += k;
+	n -= k;
+    }
+}
+
+/**
+ * @brief Initialize the framebuffer device info and map to memory
+ * @param sfb pointer to the frame buffer context pointer
+ * @param devname device name like "/dev/fb1"
+ * @return 0 on success, or < 0 on error
+ */
+int fb_init(struct sfb_s** sfb, const char* devname)
 {
     struct fb_fix_screeninfo finfo;
     struct fb_var_screeninfo vinfo;
@@ -1024,7 +7198,9 @@ int fb_init(struct sfb_s** sfb, const char* devname)
     *sfb = NULL;
     fb->magic = SFB_MAGIC;
     fb->fbp = MAP_FAILED;
+    fb->devp = MAP_FAILED;
     fb->font = &font_10x20;
+    font_index(fb->font);
 
     fb->fd = open(devname, O_RDWR);
     if (-1 == fb->fd) {
@@ -1051,6 +7227,8 @@ int fb_init(struct sfb_s** sfb, const char* devname)
     fb->bpp = vinfo.bits_per_pixel;
     fb->size = fb->w * fb->h * fb->bpp / 8;
     fb->stride = finfo.line_length;
+    fb->text_y1 = 0;
+    fb->text_y2 = fb->h - 1;
 
     // Try to memory map the framebuffer
     // Map the device to memory
@@ -1060,6 +7238,7 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	free(fb);
 	return -4;
     }
+    fb->devp = fb->fbp;
 
     // Figure out which pixel getter/setter to use
     switch (fb->bpp) {
@@ -1069,6 +7248,9 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	fb->setpixel = setpixel_1bpp;
 	fb->hline = hline_1bpp;
 	fb->vline = vline_1bpp;
+	fb->covspan = covspan_1bpp;
+	fb->blendpixel = blendpixel_1bpp;
+	fb->blendspan = blendspan_1bpp;
 	break;
     case 8:
 	fb->rgb2pix = rgb2pix_8bpp;
@@ -1076,6 +7258,9 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	fb->setpixel = setpixel_8bpp;
 	fb->hline = hline_8bpp;
 	fb->vline = vline_8bpp;
+	fb->covspan = covspan_8bpp;
+	fb->blendpixel = blendpixel_8bpp;
+	fb->blendspan = blendspan_8bpp;
 	break;
     case 16:
 	fb->rgb2pix = rgb2pix_16bpp;
@@ -1083,6 +7268,10 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	fb->setpixel = setpixel_16bpp;
 	fb->hline = hline_16bpp;
 	fb->vline = vline_16bpp;
+	fb->covspan = covspan_16bpp;
+	fb->blendpixel = blendpixel_16bpp;
+	fb->blendspan = blendspan_16bpp;
+	init_lerp_tables();
 	break;
     case 24:
 	fb->rgb2pix = rgb2pix_24bpp;
@@ -1090,6 +7279,9 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	fb->setpixel = setpixel_24bpp;
 	fb->hline = hline_24bpp;
 	fb->vline = vline_24bpp;
+	fb->covspan = covspan_24bpp;
+	fb->blendpixel = blendpixel_24bpp;
+	fb->blendspan = blendspan_24bpp;
 	break;
     case 32:
 	fb->rgb2pix = rgb2pix_32bpp;
@@ -1097,6 +7289,9 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	fb->setpixel = setpixel_32bpp;
 	fb->hline = hline_32bpp;
 	fb->vline = vline_32bpp;
+	fb->covspan = covspan_32bpp;
+	fb->blendpixel = blendpixel_32bpp;
+	fb->blendspan = blendspan_32bpp;
 	break;
     default:
 	munmap(fb->fbp, fb->size);
@@ -1104,9 +7299,19 @@ int fb_init(struct sfb_s** sfb, const char* devname)
 	free(fb);
 	return -5;
     }
+    fb->fillspan = fb->hline;
+    fb->setpixel_copy = fb->setpixel;
+    fb->hline_copy = fb->hline;
+    fb->vline_copy = fb->vline;
     fb->bgcolor = fb_color2pixel(fb, color_Black);
     fb->fgcolor = fb_color2pixel(fb, color_White);
     fb->opaque = 1;
+    fb->line_width = 1.0f;
+    fb->line_join = join_miter;
+    fb->line_cap = cap_butt;
+    fb->miter_limit = 4.0f;
+    fb->xm[0] = fb->xm[4] = 1.0f;
+    xform_update(fb);
 
     *sfb = fb;
 
@@ -1126,17 +7331,100 @@ void fb_exit(sfb_t** sfb)
     *sfb = NULL;
     CHECK_FB(fb);
 
-    if (MAP_FAILED != fb->fbp) {
-	munmap(fb->fbp, fb->size);
+    free(fb->shadow);
+    fb->shadow = NULL;
+    if (MAP_FAILED != fb->devp) {
+	munmap(fb->devp, fb->size);
+	fb->devp = MAP_FAILED;
 	fb->fbp = MAP_FAILED;
     }
     if (fb->fd >= 0) {
 	close(fb->fd);
 	fb->fd = -1;
     }
+    fb_path_exit(&fb->stroke);
+    glyph_cache_free(fb);
+    free(fb->text_stage);
+    free(fb->brush);
     free(fb);
 }
 
+/**
+ * @brief Enable or disable the shadow buffer
+ *
+ * With a shadow buffer all drawing goes to a copy of the frame buffer
+ * in normal memory, which is much faster to read than device memory.
+ * The device is updated with @ref fb_flush() or @ref fb_flush_rect().
+ * Disabling the shadow buffer flushes it first.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param enable non-zero to enable the shadow buffer
+ * @return 0 on success, -1 on error
+ */
+int fb_set_shadow(sfb_t* fb, int enable)
+{
+    CHECK_FB_RET(fb, -1);
+    if (enable && !fb->shadow) {
+	fb->shadow = (uint8_t *)malloc(fb->size);
+	if (!fb->shadow) {
+	    error(fb, "Error: insufficient memory for a %zu bytes shadow buffer", fb->size);
+	    return -1;
+	}
+	memcpy(fb->shadow, fb->devp, fb->size);
+	fb->fbp = fb->shadow;
+    } else if (!enable && fb->shadow) {
+	fb_flush(fb);
+	fb->fbp = fb->devp;
+	free(fb->shadow);
+	fb->shadow = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy the shadow buffer to the device
+ *
+ * Does nothing if there is no shadow buffer.
+ *
+ * @param fb pointer to the frame buffer context
+ */
+void fb_flush(sfb_t* fb)
+{
+    CHECK_FB(fb);
+    if (fb->shadow)
+	memcpy(fb->devp, fb->shadow, fb->size);
+}
+
+/**
+ * @brief Copy a rectangle of the shadow buffer to the device
+ *
+ * @param fb pointer to the frame buffer context
+ * @param x1 first corner x coordinate
+ * @param y1 first corner y coordinate
+ * @param x2 opposite corner x coordinate
+ * @param y2 opposite corner y coordinate
+ */
+void fb_flush_rect(sfb_t* fb, int x1, int y1, int x2, int y2)
+{
+    CHECK_FB(fb);
+    if (!fb->shadow)
+	return;
+    const int tl_x = MAX(0, MIN(x1, x2));
+    const int tl_y = MAX(0, MIN(y1, y2));
+    const int br_x = MIN(fb->w - 1, MAX(x1, x2));
+    const int br_y = MIN(fb->h - 1, MAX(y1, y2));
+    if (br_x < tl_x || br_y < tl_y)
+	return;
+    const size_t o1 = (size_t)(tl_x + fb->x) * fb->bpp / 8;
+    const size_t o2 = ((size_t)(br_x + 1 + fb->x) * fb->bpp + 7) / 8;
+    for (int y = tl_y; y <= br_y; y++) {
+	const size_t pos = (y + fb->y) * fb->stride + o1;
+	if (pos >= fb->size)
+	    break;
+	memcpy(fb->devp + pos, fb->shadow + pos, MIN(o2 - o1, fb->size - pos));
+    }
+}
+
 /**
  * @brief Select one of the integrated fonts
  * @param fb pointer to the frame buffer context
@@ -1158,6 +7446,7 @@ void fb_set_font(sfb_t* fb, font_e efont)
         fb->font = &font_10x20;
         break;
     }
+    font_index(fb->font);
 }
 
 /**
@@ -1273,6 +7562,32 @@ void fb_gotoxy(sfb_t* fb, int x, int y)
     fb->cursor_y = BOUND(y, 0, fb->h - 1);
 }
 
+/**
+ * @brief Set the text region to the rows @p y1 to @p y2
+ *
+ * Text printed with @ref fb_puts() is clipped to the text region and
+ * only the region scrolls, so a status line or a drawing above or
+ * below it stays in place. The region is the whole screen by default.
+ * The cursor moves to the top left of the region.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param y1 first row of the text region
+ * @param y2 last row of the text region
+ */
+void fb_set_text_region(sfb_t* fb, int y1, int y2)
+{
+    CHECK_FB(fb);
+    if (y1 > y2) {
+	const int y = y1;
+	y1 = y2;
+	y2 = y;
+    }
+    fb->text_y1 = BOUND(y1, 0, fb->h - 1);
+    fb->text_y2 = BOUND(y2, 0, fb->h - 1);
+    fb->cursor_x = 0;
+    fb->cursor_y = fb->text_y1;
+}
+
 /**
  * @brief Return the background mode
  * @param fb pointer to the frame buffer context
@@ -1369,35 +7684,32 @@ color_t fb_color2pixel(sfb_t* fb, color_e color)
 }
 
 /**
- * @brief Clear the framebuffer
- * @param fb pointer to the frame buffer context
+ * @brief Clear the bytes @p from to @p to (exclusive) of the frame buffer
  */
-void fb_clear(sfb_t* fb)
+static void clear_bytes(sfb_t* fb, size_t from, size_t to)
 {
-    CHECK_FB(fb);
-    assert(fb->fbp != MAP_FAILED);
     switch (fb->bpp) {
     case 1:
-	memset(fb->fbp, fb->bgcolor ? 0xff : 0x00, fb->size);
+	memset(&fb->fbp[from], fb->bgcolor ? 0xff : 0x00, to - from);
 	break;
     case 8:
-	memset(fb->fbp, fb->bgcolor, fb->size);
+	memset(&fb->fbp[from], fb->bgcolor, to - from);
 	break;
     case 16:
-	for (off_t off = 0; off < fb->size; off += 2) {
+	for (size_t off = from; off + 2 <= to; off += 2) {
 	    fb->fbp[off+0] = (uint8_t)(fb->bgcolor >> 0);
 	    fb->fbp[off+1] = (uint8_t)(fb->bgcolor >> 8);
 	}
 	break;
     case 24:
-	for (off_t off = 0; off < fb->size; off += 3) {
+	for (size_t off = from; off + 3 <= to; off += 3) {
 	    fb->fbp[off+0] = (uint8_t)(fb->bgcolor >>  0);
 	    fb->fbp[off+1] = (uint8_t)(fb->bgcolor >>  8);
 	    fb->fbp[off+2] = (uint8_t)(fb->bgcolor >> 16);
 	}
 	break;
     case 32:
-	for (off_t off = 0; off < fb->size; off += 4) {
+	for (size_t off = from; off + 4 <= to; off += 4) {
 	    fb->fbp[off+0] = (uint8_t)(fb->bgcolor >>  0);
 	    fb->fbp[off+1] = (uint8_t)(fb->bgcolor >>  8);
 	    fb->fbp[off+2] = (uint8_t)(fb->bgcolor >> 16);
@@ -1407,6 +7719,17 @@ void fb_clear(sfb_t* fb)
     }
 }
 
+/**
+ * @brief Clear the framebuffer
+ * @param fb pointer to the frame buffer context
+ */
+void fb_clear(sfb_t* fb)
+{
+    CHECK_FB(fb);
+    assert(fb->fbp != MAP_FAILED);
+    clear_bytes(fb, 0, fb->size);
+}
+
 /**
  * @brief Shift the frame buffer in one direction
  * @param fb pointer to the frame buffer context
@@ -1505,161 +7828,296 @@ void fb_vline(sfb_t* fb, int x, int y, int l)
 void fb_putc(sfb_t* fb, wchar_t wc)
 {
     CHECK_FB(fb);
-    const fbfont_t* font = fb->font;
-    uint32_t glyph = 0;
-    for (uint32_t i = 0; font->map[i]; i++) {
-	if (wc != font->map[i])
-	    continue;
-	glyph = i;
-	break;
+    const uint32_t glyph = font_glyph(fb->font, wc);
+    text_run(fb, fb->cursor_x, fb->cursor_y, &glyph, 1, 0, fb->h - 1);
+}
+
+/**
+ * @brief Decode the UTF-8 sequence at @p *pos of @p text
+ *
+ * Decoding does not depend on the locale. Overlong forms, surrogates,
+ * code points above U+10FFFF and sequences truncated by @p len or a
+ * NUL byte are invalid.
+ *
+ * @param text pointer to the UTF-8 text
+ * @param len length of @p text in bytes
+ * @param pos pointer to the offset of the sequence, advanced past it on success
+ * @return the code point, or (uint32_t)-1 if the sequence is invalid
+ */
+static uint32_t utf8_decode(const char* text, size_t len, size_t* pos)
+{
+    const uint8_t* s = (const uint8_t *)text + *pos;
+    const size_t avail = len - *pos;
+    uint32_t wc;
+    uint32_t min;
+    size_t n;
+
+    if (s[0] < 0x80) {
+	*pos += 1;
+	return s[0];
+    } else if (s[0] < 0xc2) {
+	return (uint32_t)-1;	/* continuation byte or overlong 2 byte form */
+    } else if (s[0] < 0xe0) {
+	wc = s[0] & 0x1f;
+	min = 0x80;
+	n = 2;
+    } else if (s[0] < 0xf0) {
+	wc = s[0] & 0x0f;
+	min = 0x800;
+	n = 3;
+    } else if (s[0] < 0xf5) {
+	wc = s[0] & 0x07;
+	min = 0x10000;
+	n = 4;
+    } else {
+	return (uint32_t)-1;
     }
 
-    const off_t offs = font->h * glyph;
-    if (fb->opaque) {
-	swap_fg_bg(fb);
-	/* Opaque mode: fill the glyph rectangle */
-	fb_fill(fb,
-	    fb->cursor_x, fb->cursor_y,
-	    fb->cursor_x + font->w - 1, fb->cursor_y + font->h - 1);
-	swap_fg_bg(fb);
+    for (size_t i = 1; i < n; i++) {
+	/* a NUL byte fails this test, so nothing past it is read */
+	if (i >= avail || 0x80 != (s[i] & 0xc0))
+	    return (uint32_t)-1;
+	wc = (wc << 6) | (s[i] & 0x3f);
     }
+    if (wc < min || wc > 0x10ffff || (wc >= 0xd800 && wc <= 0xdfff))
+	return (uint32_t)-1;
+    *pos += n;
+    return wc;
+}
 
-    if (font->w <= 8) {
-	/* One uint8_t per glyph row */
-        const uint8_t* data = (const uint8_t *)font->data;
-        for (int y0 = 0; y0 < font->h; y0++) {
-	    uint8_t bits = data[offs+y0] << (8 - font->w);
-	    for (int x0 = 0; bits && x0 < font->w; bits <<= 1, x0++) {
-	        if (bits & 0x80)
-		    fb->setpixel(fb, fb->cursor_x + x0, fb->cursor_y + y0);
-	    }
-        }
-    } else if (font->w <= 16) {
-	/* One uint16_t per glyph row */
-	const uint16_t* data = (const uint16_t *)font->data;
-        for (int y0 = 0; y0 < font->h; y0++) {
-	    uint16_t bits = data[offs+y0] << (16 - font->w);
-	    for (int x0 = 0; bits && x0 < font->w; bits <<= 1, x0++) {
-	        if (bits & 0x8000)
-		    fb->setpixel(fb, fb->cursor_x + x0, fb->cursor_y + y0);
-	    }
-        }
-    } else {
-	/* One uint32_t per glyph row */
-	const uint32_t* data = (const uint32_t *)font->data;
-	for (int y0 = 0; y0 < font->h; y0++) {
-	    uint32_t bits = data[offs+y0] << (32 - font->w);
-	    for (int x0 = 0; bits && x0 < font->w; bits <<= 1, x0++) {
-		if (bits & 0x80000000ul)
-		    fb->setpixel(fb, fb->cursor_x + x0, fb->cursor_y + y0);
-	    }
-	}
+/**
+ * @brief Text cursor while putting a string
+ */
+typedef struct text_cursor_s {
+    int x;			/*!< cursor x coordinate */
+    int y;			/*!< cursor y coordinate */
+    int scroll;			/*!< pixels the text region scrolled so far */
+}   text_cursor_t;
+
+/**
+ * @brief Move the text cursor @p tc to the start of the next line
+ *
+ * A line below the text region is not drawn but counted as a scroll.
+ */
+static void text_newline(const sfb_t* fb, text_cursor_t* tc)
+{
+    tc->x = 0;
+    tc->y += fb->font->h;
+    if (tc->y + fb->font->h > fb->text_y2 + 1) {
+	tc->y -= fb->font->h;
+	tc->scroll += fb->font->h;
     }
 }
 
 /**
- * @brief Put a string @p text into the framebuffer using @p color
+ * @brief Scroll the text region up by @p pixels rows in one move
+ *
+ * The rows at the bottom are cleared to zero, like @ref fb_shift() does.
+ */
+static void text_scroll(sfb_t* fb, int pixels)
+{
+    const size_t start = MIN((size_t)(fb->text_y1 + fb->y) * fb->stride, fb->size);
+    const size_t end = MIN((size_t)(fb->text_y2 + 1 + fb->y) * fb->stride, fb->size);
+    const size_t shift = MIN((size_t)pixels * fb->stride, end - start);
+
+    memmove(&fb->fbp[start], &fb->fbp[start + shift], end - start - shift);
+    memset(&fb->fbp[end - shift], 0, shift);
+}
+
+/**
+ * @brief Draw a text line collected while putting a string
+ *
+ * The text region already scrolled by @p total pixels, of which the
+ * cursor @p tc has seen tc->scroll. The line is moved up by the rest
+ * and clipped to the rows that would have stayed visible.
+ */
+static void text_flush(sfb_t* fb, const text_cursor_t* tc, int x, const uint32_t* glyph, int n, int total)
+{
+    const int rest = total - tc->scroll;
+    text_run(fb, x, tc->y - rest, glyph, n, fb->text_y1, fb->text_y2 - rest);
+}
+
+/**
+ * @brief Put at most @p len bytes of the UTF-8 string @p text into the framebuffer
+ *
+ * The text is decoded and drawn as it goes, without allocating memory
+ * and independent of the locale. It ends after @p len bytes or at a NUL
+ * byte, whichever comes first, so substrings can be printed in place.
  *
  * Some control characters are handled:
  *  '\\n' carriage return and line feed (cursor_x = 0, cursor_y += fh, scroll if off screen)
  *  '\\r' carriage return (cursor_x = 0)
+ *  '\\f' clear the text region and home the cursor
+ *
+ * Text is clipped to the text region (see @ref fb_set_text_region()).
+ * The string is measured first, so the region scrolls once by the
+ * total number of lines and only lines that stay visible are drawn.
+ *
+ * On an invalid UTF-8 sequence the characters before it are drawn
+ * and the error is reported.
  *
  * @param fb pointer to the frame buffer context
- * @param text pointer to NUL terminated string to put
+ * @param text pointer to the UTF-8 string to put
+ * @param len maximum number of bytes of @p text
+ * @return number of characters, or (size_t)-1 on invalid UTF-8
  */
-size_t fb_puts(sfb_t* fb, const char* text)
+size_t fb_putsn(sfb_t* fb, const char* text, size_t len)
 {
     CHECK_FB_RET(fb, (size_t)-1);
     const fbfont_t* font = fb->font;
+    text_cursor_t tc;
+
+    fb->cursor_y = BOUND(fb->cursor_y, fb->text_y1, fb->text_y2);
+
+    /* find the end of the valid text, the last form feed and the total scroll */
+    size_t pos = 0, start = 0, count = 0;
+    int formfeed = 0;
+    uint32_t wc = 0;
+    tc.x = fb->cursor_x;
+    tc.y = fb->cursor_y;
+    tc.scroll = 0;
+    while (pos < len && text[pos]) {
+	wc = utf8_decode(text, len, &pos);
+	if ((uint32_t)-1 == wc)
+	    break;
+	count++;
 
-    const size_t n = mbstowcs(NULL, text, 0) + 1;
-    if ((size_t)-1 == n) {
-	error(fb, "Invalid UTF-8 encoding in '%s'", text);
-	return n;
-    }
-
-    wchar_t* wtext = (wchar_t *) calloc(n, sizeof(wchar_t));
-    const size_t size = mbstowcs(wtext, text, n);
-
-    if ((size_t)-1 == size) {
-	error(fb, "Invalid UTF-8 encoding in '%s'", text);
-	return size;
-    }
-
-    if (0 == size) {
-	error(fb, "Zero length result for '%s'", text);
-	return size;
-    }
-
-    for (size_t i = 0; i < size; i++) {
-	int advance = 0;
-
-	switch (wtext[i]) {
+	switch (wc) {
 	case 0x000a:  /* new line (also does carriage return) */
-	    fb->cursor_x = 0;
-	    fb->cursor_y += font->h;
-	    /* need to scroll the frame buffer? */
-	    if (fb->cursor_y + font->h > fb->h) {
-		fb_shift(fb, shift_up, font->h);
-		fb->cursor_y -= font->h;
-	    }
+	    text_newline(fb, &tc);
 	    break;
 
-	case 0x000c:  /* form feed */
-	    fb_clear(fb);
-	    fb->cursor_x = fb->cursor_y = 0;
+	case 0x000c:  /* form feed: everything before it is cleared */
+	    tc.x = 0;
+	    tc.y = fb->text_y1;
+	    tc.scroll = 0;
+	    start = pos;
+	    formfeed = 1;
 	    break;
 
 	case 0x000d:  /* carriage return */
-	    fb->cursor_x = 0;
+	    tc.x = 0;
 	    break;
 
 	default:
-	    fb_putc(fb, wtext[i]);
-	    advance = 1;
+	    tc.x += font->w;
+	    if (tc.x + font->w >= fb->w)
+		text_newline(fb, &tc);
 	    break;
 	}
-
-	if (!advance) {
-	    continue;
+    }
+    const size_t end = pos;
+    const int total = tc.scroll;
+
+    if (formfeed) {
+	clear_bytes(fb, MIN((size_t)(fb->text_y1 + fb->y) * fb->stride, fb->size),
+	    MIN((size_t)(fb->text_y2 + 1 + fb->y) * fb->stride, fb->size));
+	fb->cursor_x = 0;
+	fb->cursor_y = fb->text_y1;
+    }
+    if (total > 0)
+	text_scroll(fb, total);
+
+    /* printable characters are collected and drawn a text line at a time */
+    uint32_t glyph[TEXT_GLYPHS];
+    int nglyph = 0;
+    int x = 0;
+
+    tc.x = fb->cursor_x;
+    tc.y = fb->cursor_y;
+    tc.scroll = 0;
+    pos = start;
+    while (pos < end) {
+	const uint32_t c = utf8_decode(text, len, &pos);
+
+	if (nglyph > 0 && (c < 0x0020 || TEXT_GLYPHS == nglyph)) {
+	    text_flush(fb, &tc, x, glyph, nglyph, total);
+	    nglyph = 0;
 	}
 
-	fb->cursor_x += font->w;
-	if (fb->cursor_x + font->w >= fb->w) {
-	    fb->cursor_x = 0;
-	    fb->cursor_y += font->h;
-	    if (fb->cursor_y + font->h >= fb->h) {
-		fb->cursor_y -= font->h;
-		fb_shift(fb, shift_up, font->h);
+	switch (c) {
+	case 0x000a:  /* new line (also does carriage return) */
+	    text_newline(fb, &tc);
+	    break;
+
+	case 0x000d:  /* carriage return */
+	    tc.x = 0;
+	    break;
+
+	default:
+	    if (0 == nglyph)
+		x = tc.x;
+	    glyph[nglyph++] = font_glyph(font, (wchar_t)c);
+	    tc.x += font->w;
+	    if (tc.x + font->w >= fb->w) {
+		text_flush(fb, &tc, x, glyph, nglyph, total);
+		nglyph = 0;
+		text_newline(fb, &tc);
 	    }
+	    break;
 	}
     }
-    free(wtext);
-    return size;
+    if (nglyph > 0)
+	text_flush(fb, &tc, x, glyph, nglyph, total);
+    fb->cursor_x = tc.x;
+    fb->cursor_y = tc.y;
+
+    if ((uint32_t)-1 == wc) {
+	error(fb, "Invalid UTF-8 encoding at offset %zu in '%.*s'", pos, (int)MIN(len, 64), text);
+	return (size_t)-1;
+    }
+    return count;
+}
+
+/**
+ * @brief Put a string @p text into the framebuffer
+ *
+ * See @ref fb_putsn() for the handling of control characters.
+ *
+ * @param fb pointer to the frame buffer context
+ * @param text pointer to NUL terminated UTF-8 string to put
+ * @return number of characters, or (size_t)-1 on invalid UTF-8
+ */
+size_t fb_puts(sfb_t* fb, const char* text)
+{
+    CHECK_FB_RET(fb, (size_t)-1);
+    return fb_putsn(fb, text, (size_t)-1);
 }
 
 /**
  * @brief Print a format string and its arguments
  *
+ * Output shorter than @ref PRINTF_STACK bytes is formatted on the stack,
+ * only longer output allocates a buffer.
+ *
  * @param fb pointer to the frame buffer context
  * @param format C format string
  * @param ap a va_list of arguments
+ * @return number of characters, or (size_t)-1 on error
  */
 static size_t fb_vprintf(sfb_t* fb, const char* format, va_list ap)
 {
     CHECK_FB_RET(fb, (size_t)-1);
-
-    size_t size = vsnprintf(NULL, 0, format, ap);
-    char* buffer = (char *)calloc(1, size + 1);
-    if (NULL == buffer) {
-	error(fb, "Error: insufficient memory for fb_vprintf() (%u)", size);
+    char stack[PRINTF_STACK];
+    va_list aq;
+
+    va_copy(aq, ap);
+    const int len = vsnprintf(stack, sizeof(stack), format, aq);
+    va_end(aq);
+    if (len < 0) {
+	error(fb, "Error: formatting '%s' failed in fb_vprintf()", format);
 	return (size_t)-1;
     }
+    if ((size_t)len < sizeof(stack))
+	return fb_putsn(fb, stack, (size_t)len);
 
-    size = vsnprintf(buffer, size, format, ap);
-    if ((int)size > 0) {
-	fb_puts(fb, buffer);
+    char* buffer = (char *)malloc((size_t)len + 1);
+    if (NULL == buffer) {
+	error(fb, "Error: insufficient memory for fb_vprintf() (%d)", len + 1);
+	return (size_t)-1;
     }
+    vsnprintf(buffer, (size_t)len + 1, format, ap);
+    const size_t size = fb_putsn(fb, buffer, (size_t)len);
     free(buffer);
     return size;
 }
@@ -1669,6 +8127,7 @@ static size_t fb_vprintf(sfb_t* fb, const char* format, va_list ap)
  *
  * @param fb pointer to the frame buffer context
  * @param format C format string followed by optional arguments
+ * @return number of characters, or (size_t)-1 on error
  */
 size_t fb_printf(sfb_t* fb, const char* format, ...)
 {
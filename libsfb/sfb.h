@@ -33,6 +33,8 @@
 #include <sys/types.h>
 
 struct sfb_s;
+struct sfb_path_s;
+struct sfb_sprite_s;
 struct gdImageStruct;
 typedef struct gdImageStruct* gdImagePtr;
 
@@ -48,6 +50,73 @@ typedef enum {
 
 typedef unsigned color_t;
 
+/**
+ * @brief Premultiplied ARGB 8-8-8-8 value for the compositing functions
+ */
+typedef unsigned argb_t;
+
+/**
+ * @brief Sampling filter for @ref fb_blit_transformed()
+ */
+typedef enum {
+    filter_nearest,
+    filter_bilinear
+}   filter_e;
+
+/**
+ * @brief Raster operation for drawing, see @ref fb_set_rop()
+ */
+typedef enum {
+    rop_copy,
+    rop_xor,
+    rop_and,
+    rop_or,
+    rop_invert
+}   rop_e;
+
+/**
+ * @brief Join style for strokes, see @ref fb_set_line_join()
+ */
+typedef enum {
+    join_miter,
+    join_round,
+    join_bevel
+}   line_join_e;
+
+/**
+ * @brief Cap style for strokes, see @ref fb_set_line_cap()
+ */
+typedef enum {
+    cap_butt,
+    cap_round,
+    cap_square
+}   line_cap_e;
+
+/**
+ * @brief A point (vertex) in frame buffer coordinates
+ */
+typedef struct {
+    int x;
+    int y;
+}   point_t;
+
+/**
+ * @brief A vertex with a premultiplied ARGB color for @ref fb_triangle_mesh()
+ */
+typedef struct {
+    int x;
+    int y;
+    argb_t color;
+}   vertex_t;
+
+/**
+ * @brief Fill rule for @ref fb_polygon_fill()
+ */
+typedef enum {
+    fill_even_odd,
+    fill_non_zero
+}   fill_rule_e;
+
 #define RGB(r,g,b) (((color_t)r) << 16) | (((color_t)g) << 8) | (((color_t)b) << 0)
 
 /**
@@ -213,6 +282,9 @@ typedef enum {
 
 extern int fb_init(struct sfb_s** psfb, const char* devname);
 extern void fb_exit(struct sfb_s** psfb);
+extern int fb_set_shadow(struct sfb_s* sfb, int enable);
+extern void fb_flush(struct sfb_s* sfb);
+extern void fb_flush_rect(struct sfb_s* sfb, int x1, int y1, int x2, int y2);
 extern void fb_set_font(struct sfb_s* sfb, font_e efont);
 
 extern const char* fb_devname(struct sfb_s* sfb);
@@ -226,12 +298,32 @@ extern int fb_cy(struct sfb_s* sfb);
 extern int fb_font_w(struct sfb_s* sfb);
 extern int fb_font_h(struct sfb_s* sfb);
 extern void fb_gotoxy(struct sfb_s* sfb, int x, int y);
+extern void fb_set_text_region(struct sfb_s* sfb, int y1, int y2);
 extern int fb_opaque(struct sfb_s* sfb);
 extern color_t fb_bgcolor(struct sfb_s* sfb);
 extern color_t fb_fgcolor(struct sfb_s* sfb);
 extern void fb_set_opaque(struct sfb_s* sfb, int opaque);
 extern void fb_set_bgcolor(struct sfb_s* sfb, color_t bg);
 extern void fb_set_fgcolor(struct sfb_s* sfb, color_t fg);
+extern rop_e fb_rop(struct sfb_s* sfb);
+extern float fb_line_width(struct sfb_s* sfb);
+extern void fb_set_line_width(struct sfb_s* sfb, float width);
+extern void fb_set_line_join(struct sfb_s* sfb, line_join_e join);
+extern void fb_set_line_cap(struct sfb_s* sfb, line_cap_e cap);
+extern void fb_set_miter_limit(struct sfb_s* sfb, float limit);
+extern void fb_set_dash(struct sfb_s* sfb, const float* dash, int n, float offset);
+extern void fb_set_dither(struct sfb_s* sfb, int dither);
+extern void fb_set_brush_solid(struct sfb_s* sfb);
+extern void fb_set_brush_stipple(struct sfb_s* sfb, const unsigned char bits[8]);
+extern void fb_set_brush_pixmap(struct sfb_s* sfb, const argb_t* src, int w, int h, int stride);
+extern void fb_set_brush_tile(struct sfb_s* sfb, int x, int y, int w, int h);
+extern void fb_set_brush_origin(struct sfb_s* sfb, int x, int y);
+extern void fb_set_rop(struct sfb_s* sfb, rop_e rop);
+extern void fb_set_transform(struct sfb_s* sfb, float a, float b, float c, float d, float e, float f);
+extern void fb_reset_transform(struct sfb_s* sfb);
+extern void fb_translate(struct sfb_s* sfb, float tx, float ty);
+extern void fb_scale(struct sfb_s* sfb, float sx, float sy);
+extern void fb_rotate(struct sfb_s* sfb, float angle);
 
 extern color_t fb_rgb2pixel(struct sfb_s* sfb, int r, int g, int b);
 extern color_t fb_color2pixel(struct sfb_s* sfb, color_e color);
@@ -242,15 +334,61 @@ extern void fb_setpixel(struct sfb_s* sfb, int x, int y);
 extern void fb_hline(struct sfb_s* sfb, int x, int y, int l);
 extern void fb_vline(struct sfb_s* sfb, int x, int y, int l);
 
+extern void fb_points(struct sfb_s* sfb, const point_t* points, int n, const color_t* colors);
+extern void fb_points_sorted(struct sfb_s* sfb, const point_t* points, int n, const color_t* colors);
 extern void fb_line(struct sfb_s* sfb, int x1, int y1, int x2, int y2);
+extern void fb_aaline(struct sfb_s* sfb, int x1, int y1, int x2, int y2);
 extern void fb_rect(struct sfb_s* sfb, int x1, int y1, int x2, int y2);
 extern void fb_fill(struct sfb_s* sfb, int x1, int y1, int x2, int y2);
+extern void fb_bitmap(struct sfb_s* sfb, int x, int y, int w, int h, const unsigned char* bits, int stride);
+extern int fb_sprite_init(struct sfb_s* sfb, struct sfb_sprite_s** psprite, const argb_t* src, int w, int h, int stride);
+extern int fb_sprite_init_gd(struct sfb_s* sfb, struct sfb_sprite_s** psprite, gdImagePtr im);
+extern void fb_sprite_exit(struct sfb_sprite_s** psprite);
+extern void fb_sprite_blit(struct sfb_s* sfb, const struct sfb_sprite_s* sprite, int x, int y);
+extern void fb_blit_transformed(struct sfb_s* sfb, int x, int y, const argb_t* src, int w, int h, int stride,
+	float px, float py, float angle, float scale, filter_e filter);
+extern void fb_fill_alpha(struct sfb_s* sfb, int x1, int y1, int x2, int y2, int alpha);
+extern void fb_blend_rect(struct sfb_s* sfb, int x1, int y1, int x2, int y2, argb_t argb);
+extern void fb_fill_linear(struct sfb_s* sfb, int x1, int y1, int x2, int y2,
+	int gx0, int gy0, argb_t c0, int gx1, int gy1, argb_t c1);
+extern void fb_fill_radial(struct sfb_s* sfb, int x1, int y1, int x2, int y2,
+	int cx, int cy, int r, argb_t c0, argb_t c1);
+extern int fb_flood_fill(struct sfb_s* sfb, int x, int y);
+extern int fb_blur_box(struct sfb_s* sfb, int x1, int y1, int x2, int y2, int r);
+extern int fb_blur(struct sfb_s* sfb, int x1, int y1, int x2, int y2, float sigma);
+extern void fb_blit_blend(struct sfb_s* sfb, int x, int y, const argb_t* src, int w, int h, int stride);
+extern void fb_blit_gd(struct sfb_s* sfb, int x, int y, gdImagePtr im);
 extern void fb_circle_octants(struct sfb_s* sfb, unsigned char oct, int x, int y, int r);
 extern void fb_circle(struct sfb_s* sfb, int x, int y, int r);
 extern void fb_disc_octants(struct sfb_s* sfb, unsigned char oct, int x, int y, int r);
 extern void fb_disc(struct sfb_s* sfb, int x, int y, int r);
+extern void fb_aacircle(struct sfb_s* sfb, int x, int y, int r);
+extern void fb_aadisc(struct sfb_s* sfb, int x, int y, int r);
+extern void fb_aaring(struct sfb_s* sfb, int x, int y, int r1, int r2);
+extern void fb_aaarc(struct sfb_s* sfb, int x, int y, int r, int start, int end);
+extern void fb_ellipse(struct sfb_s* sfb, int x, int y, int rx, int ry);
+extern void fb_ellipse_fill(struct sfb_s* sfb, int x, int y, int rx, int ry);
+extern void fb_arc(struct sfb_s* sfb, int x, int y, int rx, int ry, int start, int end);
+extern void fb_polygon(struct sfb_s* sfb, const point_t* points, int n);
+extern void fb_polygon_fill(struct sfb_s* sfb, const point_t* points, int n, fill_rule_e rule);
+extern void fb_triangle(struct sfb_s* sfb, const vertex_t* v);
+extern void fb_triangle_mesh(struct sfb_s* sfb, const vertex_t* v, int nv, const int* index, int ntri);
+extern int fb_path_init(struct sfb_path_s** ppath);
+extern void fb_path_exit(struct sfb_path_s** ppath);
+extern void fb_path_reset(struct sfb_path_s* path);
+extern int fb_path_moveto(struct sfb_path_s* path, float x, float y);
+extern void fb_path_lineto(struct sfb_path_s* path, float x, float y);
+extern void fb_path_quadto(struct sfb_path_s* path, float x1, float y1, float x, float y);
+extern void fb_path_cubicto(struct sfb_path_s* path, float x1, float y1, float x2, float y2, float x, float y);
+extern void fb_path_close(struct sfb_path_s* path);
+extern void fb_path_fill(struct sfb_s* sfb, const struct sfb_path_s* path);
+extern void fb_path_stroke(struct sfb_s* sfb, const struct sfb_path_s* path);
+extern void fb_polyline(struct sfb_s* sfb, const point_t* points, int n);
+extern void fb_bezier2(struct sfb_s* sfb, int x0, int y0, int x1, int y1, int x2, int y2);
+extern void fb_bezier3(struct sfb_s* sfb, int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3);
 extern void fb_shift(struct sfb_s* sfb, shift_dir_e dir, int pixels);
 extern void fb_putc(struct sfb_s* sfb, wchar_t wc);
 extern size_t fb_puts(struct sfb_s* sfb, const char* text);
+extern size_t fb_putsn(struct sfb_s* sfb, const char* text, size_t len);
 extern size_t fb_printf(struct sfb_s* sfb, const char* format, ...);
 extern void fb_dump(struct sfb_s* sfb, gdImagePtr im);
@@ -173,6 +173,37 @@ void test_circles(struct sfb_s* sfb, int us)
     }
 }
 
+/**
+ * @brief A simple test drawing ellipses and elliptical arcs across the TFT
+ * @param sfb pointer to the libsfb context
+ * @param us number of microseconds to delay between drawing
+ */
+void test_ellipses(struct sfb_s* sfb, int us)
+{
+    for (int n = 0; n < 5000; n++) {
+	const int x = rand() % fb_w(sfb);
+	const int y = rand() % fb_h(sfb);
+	const int rx = rand() % 64;
+	const int ry = rand() % 64;
+	const uint32_t color = rand() & 0x00ffffff;
+	fb_set_fgcolor(sfb, color);
+	switch (rand() % 3) {
+	case 0:
+	    fb_ellipse_fill(sfb, x, y, rx, ry);
+	    break;
+	case 1:
+	    fb_ellipse(sfb, x, y, rx, ry);
+	    break;
+	default:
+	    fb_arc(sfb, x, y, rx, ry, rand() % 360, rand() % 360);
+	    break;
+	}
+	if (us) {
+	    usleep(us);
+	}
+    }
+}
+
 /**
  * @brief A simple test writing a text to the TFT display
  * @param sfb pointer to the libsfb context
@@ -381,6 +412,7 @@ int main(int argc, char** argv)
 	test_lines(sfb, us);
 	test_text(sfb, us);
 	test_circles(sfb, us);
+	test_ellipses(sfb, us);
 	usage(program);
 	return 1;
     }